@@ -208,6 +208,8 @@ PYBIND11_MODULE(_libspecex, m) {
         .def_readwrite("output_fits_filename", &spx::PyOptions::output_fits_filename)
         .def_readwrite("trace_deg_x",          &spx::PyOptions::trace_deg_x)
         .def_readwrite("trace_deg_wave",       &spx::PyOptions::trace_deg_wave)
+        .def_readwrite("bundle_threads",       &spx::PyOptions::bundle_threads)
+        .def_readwrite("number_of_threads",    &spx::PyOptions::number_of_threads)
 
         .def("parse", [](spx::PyOptions &self, std::vector<std::string>& args){
 	    std::vector<char *> cstrs;
@@ -16,27 +16,33 @@ double specex_dot(int n, const double *x, const double *y){
 // y += alpha*x
 // http://www.netlib.org/lapack/explore-html/d9/dcd/daxpy_8f_source.html
 void specex_axpy(int n, const double *alpha, const double *x, const double *y){
-  cblas_daxpy(n, *alpha, x, 1, y, 1);  
+  cblas_daxpy(n, *alpha, x, 1, (double*)y, 1);  
 }
 
 // A += alpha*x*x**T, where A is a symmetric matrx (only lower half is filled)
 // http://www.netlib.org/lapack/explore-html/d3/d60/dsyr_8f_source.html
 void specex_syr(int n, const double *alpha, const double *x, const double *A){
-  cblas_dsyr(CblasColMajor, CblasLower, n, *alpha, x, 1, A, n);  
+  cblas_dsyr(CblasColMajor, CblasLower, n, *alpha, x, 1, (double*)A, n);  
 }
 
 // C = alpha*A**T + beta*C, where A is a symmetric matrx 
 // http://www.netlib.org/lapack/explore-html/dc/d05/dsyrk_8f_source.html
 void specex_syrk(int n, int k, const double *alpha, const double *A, const double *beta,
 		 const double *C){
-  cblas_dsyrk(CblasColMajor, CblasLower, CblasNoTrans, n, k, *alpha, A, n, *beta, C, n);  
+  cblas_dsyrk(CblasColMajor, CblasLower, CblasNoTrans, n, k, *alpha, A, n, *beta, (double*)C, n);  
+}
+
+// C = alpha*A**T*A + beta*C, where C is a symmetric matrix (only lower half is filled), A is k x n
+void specex_syrk_t(int n, int k, const double *alpha, const double *A, const double *beta,
+		   const double *C){
+  cblas_dsyrk(CblasColMajor, CblasLower, CblasTrans, n, k, *alpha, A, k, *beta, (double*)C, n);  
 }
 
 // y = alpha*A*x + beta*y
 // http://www.netlib.org/lapack/explore-html/dc/da8/dgemv_8f_source.html
 void specex_gemv(int m, int n, const double *alpha, const double *A, const double *x,
 		 const double *beta, const double *y){
-  cblas_dgemv(CblasColMajor, CblasNoTrans, m, n, *alpha, A, m, x, 1, *beta, y, 1);
+  cblas_dgemv(CblasColMajor, CblasNoTrans, m, n, *alpha, A, m, x, 1, *beta, (double*)y, 1);
   
 }
 
@@ -44,6 +50,6 @@ void specex_gemv(int m, int n, const double *alpha, const double *A, const doubl
 // http://www.netlib.org/lapack/explore-html/d7/d2b/dgemm_8f_source.html
 void specex_gemm(int m, int n, int k, const double *alpha, const double *A, const double *B,
 		 const double *beta, const double *C){
-  cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, m, n, k, *alpha, A, m, B, k, *beta, C, m);  
+  cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, m, n, k, *alpha, A, m, B, k, *beta, (double*)C, m);  
 }
 
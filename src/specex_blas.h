@@ -7,6 +7,8 @@ extern "C" {
   void specex_syr(int, const double *, const double *, const double *);
   void specex_syrk(int, int, const double *, const double *, const double *,
 		   const double *);  
+  void specex_syrk_t(int, int, const double *, const double *, const double *,
+		     const double *);  
   void specex_gemv(int, int, const double *, const double *, const double *,
 		   const double *, const double*);
   void specex_gemm(int, int, int, const double *, const double *, const double *,
@@ -24,6 +24,7 @@ specex::GaussHermitePSF::GaussHermitePSF(int ideg) : PSF()
 
 void specex::GaussHermitePSF::SetDegree(const int ideg) {
   degree = ideg;
+  SetKernels();
 }
 
 
@@ -48,22 +49,35 @@ double specex::GaussHermitePSF::Profile(const double &input_X, const double &inp
   int ny=(degree+1);
   int nc=nx*ny-1; // skip (0,0)
   
-  // precompute to go faster
-  unbls::vector_double Monomials;
-  unbls::vector_double Monomials_dx;
-  unbls::vector_double Monomials_dy;
+  // precompute to go faster (per-thread scratch)
+  thread_local unbls::vector_double Monomials;
+  thread_local unbls::vector_double Monomials_dx;
+  thread_local unbls::vector_double Monomials_dy;
   double prefactor=1;
   int first_hermite_param_index = 2; // first 2 params are sigmas
   double expfact=1./(2*M_PI)*sigma_x_inv*sigma_y_inv*exp(-0.5*(x*x+y*y));
 
+  // hermite polynomials and derivatives
+  thread_local unbls::vector_double Hx,Hy,dHx,dHy;
+  Hx.resize(nx);
+  Hy.resize(ny);
+  if(PosDer || ParamDer) {
+    dHx.resize(nx);
+    dHy.resize(ny);
+    HermitePols(degree,x,&Hx[0],&dHx[0]);
+    HermitePols(degree,y,&Hy[0],&dHy[0]);
+  }else{
+    HermitePols(degree,x,&Hx[0]);
+    HermitePols(degree,y,&Hy[0]);
+  }
 
   if(PosDer==0 && ParamDer==0) {
     int param_index=first_hermite_param_index;
     for(int j=0;j<ny;j++) {
-      double Hyj=HermitePol(j,y);
+      double Hyj=Hy[j];
       int imin=0; if(j==0) imin=1; // skip (0,0)
       for(int i=imin;i<nx;i++,param_index++) {
-	prefactor+=Params[param_index]*Hyj*HermitePol(i,x);
+	prefactor+=Params[param_index]*Hyj*Hx[i];
       }
     }
     return expfact*prefactor;
@@ -74,13 +88,13 @@ double specex::GaussHermitePSF::Profile(const double &input_X, const double &inp
     Monomials_dy.resize(nc);
     int index=0;
     for(int j=0;j<ny;j++) {
-      double Hyj=HermitePol(j,y);
-      double dHyj=HermitePolDerivative(j,y);
+      double Hyj=Hy[j];
+      double dHyj=dHy[j];
       int imin=0; if(j==0) imin=1; // skip (0,0)
       for(int i=imin;i<nx;i++,index++) {
-	double Hxi=HermitePol(i,x);
+	double Hxi=Hx[i];
 	Monomials[index]=Hyj*Hxi;
-	Monomials_dx[index]=Hyj*HermitePolDerivative(i,x);
+	Monomials_dx[index]=Hyj*dHx[i];
 	Monomials_dy[index]=dHyj*Hxi;
       }
     }
@@ -92,14 +106,14 @@ double specex::GaussHermitePSF::Profile(const double &input_X, const double &inp
     int param_index=first_hermite_param_index;
     int index=0;
     for(int j=0;j<ny;j++) {
-      double Hyj=HermitePol(j,y);
-      double dHyj=HermitePolDerivative(j,y);
+      double Hyj=Hy[j];
+      double dHyj=dHy[j];
       int imin=0; if(j==0) imin=1; // skip (0,0)
       for(int i=imin;i<nx;i++,index++,param_index++) {
 	
-	double Hxi=HermitePol(i,x);
+	double Hxi=Hx[i];
 	prefactor+=Params[param_index]*Hxi*Hyj;
-	Monomials_dx[index]=Hyj*HermitePolDerivative(i,x);
+	Monomials_dx[index]=Hyj*dHx[i];
 	Monomials_dy[index]=dHyj*Hxi;
       }
     }
@@ -217,6 +231,25 @@ double specex::GaussHermitePSF::PixValue(const double &Xc, const double &Yc,
   double Pj=0;
   
   double psfval=0;
+  
+  // hermite polynomials up to degree-1 (and their derivatives) on the edges of the pixel
+  const bool with_derivatives = (PosDer || ParamDer);
+  thread_local unbls::vector_double hermite; // per-thread scratch
+  hermite.resize((with_derivatives) ? 8*nx : 4*nx);
+  double* Hx1 = &hermite[0];
+  double* Hx2 = Hx1+nx;
+  double* Hy1 = Hx2+nx;
+  double* Hy2 = Hy1+nx;
+  double* dHx1 = (with_derivatives) ? Hy2+nx : 0;
+  double* dHx2 = (with_derivatives) ? dHx1+nx : 0;
+  double* dHy1 = (with_derivatives) ? dHx2+nx : 0;
+  double* dHy2 = (with_derivatives) ? dHy1+nx : 0;
+  if(degree>0) {
+    HermitePols(degree-1,x1,Hx1,dHx1);
+    HermitePols(degree-1,x2,Hx2,dHx2);
+    HermitePols(degree-1,y1,Hy1,dHy1);
+    HermitePols(degree-1,y2,Hy2,dHy2);
+  }
 
   if(PosDer==0 && ParamDer==0) { // no computation of derivatives, just value
     
@@ -230,7 +263,7 @@ double specex::GaussHermitePSF::PixValue(const double &Xc, const double &Yc,
       if(j==0)
 	Pj=ey;
       else 
-	Pj=sy*( gy1*HermitePol(j-1,y1)-gy2*HermitePol(j-1,y2) );
+	Pj=sy*( gy1*Hy1[j-1]-gy2*Hy2[j-1] );
 
       int imin=0; if(j==0) imin=1; // skip (0,0)
       for(int i=imin;i<nx;i++,param_index++) {
@@ -238,7 +271,7 @@ double specex::GaussHermitePSF::PixValue(const double &Xc, const double &Yc,
 	if(i==0)
 	  Pi=ex;
 	else 
-	  Pi=sx*( gx1*HermitePol(i-1,x1)-gx2*HermitePol(i-1,x2) );
+	  Pi=sx*( gx1*Hx1[i-1]-gx2*Hx2[i-1] );
 	
 	psfval+=Params[param_index]*Pj*Pi;
       }
@@ -260,19 +293,17 @@ double specex::GaussHermitePSF::PixValue(const double &Xc, const double &Yc,
 
   // full derivative computation
   // PiPj = int_{x1,y1}^{x2,y2} dx dy exp(-(x**2+y**2)/2) * Hi(x) * Hj(y)
-  unbls::vector_double PiPj(nc);    
-  unbls::vector_double dPiPjdsx(nc);// derivative wrt sigma
-  unbls::vector_double dPiPjdsy(nc);
-  unbls::vector_double dPiPjdx(nc);// derivative wrt x
-  unbls::vector_double dPiPjdy(nc);
+  thread_local unbls::vector_double PiPj; // per-thread scratch
+  thread_local unbls::vector_double dPiPjdsx;// derivative wrt sigma
+  thread_local unbls::vector_double dPiPjdsy;
+  thread_local unbls::vector_double dPiPjdx;// derivative wrt x
+  thread_local unbls::vector_double dPiPjdy;
 
-  /*
   PiPj.resize(nc);
   dPiPjdsx.resize(nc); // derivative wrt sigma
   dPiPjdsy.resize(nc);
   dPiPjdx.resize(nc); // derivative wrt x
   dPiPjdy.resize(nc);
-  */
  
  
   
@@ -293,12 +324,12 @@ double specex::GaussHermitePSF::PixValue(const double &Xc, const double &Yc,
 	
       }
       else {
-	t1=sy*gy1*HermitePol(j-1,y1);
-	t2=sy*gy2*HermitePol(j-1,y2);
+	t1=sy*gy1*Hy1[j-1];
+	t2=sy*gy2*Hy2[j-1];
 	Pj= t1 - t2;
-	dPjdsy = ( -gy1*y1*HermitePolDerivative(j-1,y1)+gy2*y2*HermitePolDerivative(j-1,y2) )
+	dPjdsy = ( -gy1*y1*dHy1[j-1]+gy2*y2*dHy2[j-1] )
 	  + ( t1*y1*y1*isy - t2*y2*y2*isy ); // VALIDATED	
-	dPjdy = -isy*( sy*gy1*HermitePolDerivative(j-1,y1)-sy*gy2*HermitePolDerivative(j-1,y2) - y1*t1 + y2*t2  ); // minus sign because derivatice wrt yc  , VALIDATED 
+	dPjdy = -isy*( sy*gy1*dHy1[j-1]-sy*gy2*dHy2[j-1] - y1*t1 + y2*t2  ); // minus sign because derivatice wrt yc  , VALIDATED 
       }
       
       
@@ -311,19 +342,19 @@ double specex::GaussHermitePSF::PixValue(const double &Xc, const double &Yc,
 	  dPidx=dexdx;
 	}
 	else {
-	  t1=sx*gx1*HermitePol(i-1,x1); 
-	  t2=sx*gx2*HermitePol(i-1,x2);
+	  t1=sx*gx1*Hx1[i-1]; 
+	  t2=sx*gx2*Hx2[i-1];
 	  Pi= t1 - t2 ; // VALIDATED
 	  // t = sx*gx*H(x) = sx*isq2pi*isx*exp(-0.5*x**2)*H(x) 
 	  // t = a*g(x)*H(x)
 	  // dH/ds = dH/dx * dx/ds = dH/dx * -x/s
 	  // dg/ds = dg/dx * dx/s  = -x*g * -x/s = x**2/s * g
 	  // dt/ds = a*g*dH/ds + a*dg/ds*H = a*g * dH/dx * -x/s + a*g*H*x**2/s 
-	  dPidsx = ( -gx1*x1*HermitePolDerivative(i-1,x1)+gx2*x2*HermitePolDerivative(i-1,x2) )
+	  dPidsx = ( -gx1*x1*dHx1[i-1]+gx2*x2*dHx2[i-1] )
 	    + ( t1*x1*x1*isx - t2*x2*x2*isx ); // VALIDATED
 
 	  // dt/dx = a*g*dH/dx + a*dg/dx*H = a*g * dH/dx - a*g*H*x 	  
-	  dPidx = -isx*( sx*gx1*HermitePolDerivative(i-1,x1)-sx*gx2*HermitePolDerivative(i-1,x2) - x1*t1 + x2*t2  ); // minus sign because derivatice wrt xc  , VALIDATED
+	  dPidx = -isx*( sx*gx1*dHx1[i-1]-sx*gx2*dHx2[i-1] - x1*t1 + x2*t2  ); // minus sign because derivatice wrt xc  , VALIDATED
 	 
 	}
 	PiPj[index]=Pi*Pj;
@@ -357,6 +388,280 @@ double specex::GaussHermitePSF::PixValue(const double &Xc, const double &Yc,
 
 }
   
+/*
+  The pixel integral of the core is separable :
+  PixValue(i,j) = sum_kl c_kl Pk(i) Pl(j) with c_00 = 1 and Pk(i) = int_{pixel i} dx Hk(x) g(x) (see PixValue above)
+  
+  Per column i, we store (n = degree+1 terms each, x_terms[term*ncols+column] so that rows are contiguous)
+  Qx_l(i) = sum_k c_kl Pk(i) , and with derivatives Pk(i), sum_k c_kl dPk(i)/dsx , sum_k c_kl dPk(i)/dxc
+  Per row j, we store
+  Pl(j) , and with derivatives dPl(j)/dsy, dPl(j)/dyc
+  
+  so that the value is sum_l Qx_l(i)*Pl(j), and the derivatives follow the same way.
+  Pixel edges are shared by neighbouring columns (rows), so erf and exp are evaluated 
+  only once per edge.
+*/
+
+// fills per pixel P_k, dP_k/ds and dP_k/dc (c is the center) , k=0..n-1 , along one axis , for pixels [begin,end[
+static void gauss_hermite_1d_pixel_integrals(const double& center, const double& sigma, int n, int begin, int end, bool with_derivatives,
+					     unbls::vector_double& P, unbls::vector_double& dPds, unbls::vector_double& dPdc) {
+  
+  const double isigma = 1./sigma;
+  const double isq2 = 1./sqrt(2.);
+  const double isq2pi = 1./sqrt(2.*M_PI);
+  
+  int npix = end-begin;
+  int nedges = npix+1;
+  
+  // values on pixel edges (per-thread scratch)
+  thread_local unbls::vector_double e,g,erfe,H,dH;
+  e.resize(nedges);
+  g.resize(nedges);
+  erfe.resize(nedges);
+  H.resize(nedges*n);
+  if(with_derivatives) dH.resize(nedges*n);
+  
+  for(int k=0;k<nedges;k++) {
+    e[k]    = (begin + k - center - 0.5)*isigma;
+    g[k]    = isq2pi*isigma*exp(-0.5*(e[k]*e[k]));
+    erfe[k] = erf(e[k]*isq2);
+    if(n>1) specex::HermitePols(n-2,e[k],&H[k*n],(with_derivatives) ? &dH[k*n] : 0);
+  }
+  
+  P.resize(npix*n);
+  if(with_derivatives) {
+    dPds.resize(npix*n);
+    dPdc.resize(npix*n);
+  }
+  
+  for(int p=0;p<npix;p++) {
+    const double& x1 = e[p];
+    const double& x2 = e[p+1];
+    const double& g1 = g[p];
+    const double& g2 = g[p+1];
+    
+    P[p*n] = 0.5*(erfe[p+1]-erfe[p]);
+    if(with_derivatives) {
+      dPds[p*n] = (x1*g1 - x2*g2);
+      dPdc[p*n] = (g1 - g2);
+    }
+    for(int d=1;d<n;d++) {
+      double t1 = sigma*g1*H[p*n+d-1];
+      double t2 = sigma*g2*H[(p+1)*n+d-1];
+      P[p*n+d] = t1 - t2;
+      if(with_derivatives) {
+	const double& dH1 = dH[p*n+d-1];
+	const double& dH2 = dH[(p+1)*n+d-1];
+	dPds[p*n+d] = ( -g1*x1*dH1 + g2*x2*dH2 ) + ( t1*x1*x1*isigma - t2*x2*x2*isigma );
+	dPdc[p*n+d] = -isigma*( sigma*g1*dH1 - sigma*g2*dH2 - x1*t1 + x2*t2 ); // derivative wrt center
+      }
+    }
+  }
+}
+
+/*
+  Kernels working on the stamp cache, templated on the number of terms per axis N=degree+1.
+  N=0 is the generic version with the number of terms n known at run time ;
+  the specialized versions (N>0, instantiated for degree 3 to 8) have compile time loop bounds,
+  and the coefficients kept in a fixed size array.
+*/
+
+template<int N> static void gauss_hermite_contract_columns(const int runtime_n, const int ncols, const unbls::vector_double &Params, bool with_derivatives,
+							   const unbls::vector_double& Px, const unbls::vector_double& dPxds, const unbls::vector_double& dPxdc,
+							   double* x_terms) {
+  const int n = (N>0) ? N : runtime_n;
+  const int first_hermite_param_index = 2; // first 2 params are sigmas
+  
+  // coefficients c_kl, with c_00 = 1
+  double fixed_coefs[(N>0) ? N*N : 1];
+  thread_local unbls::vector_double runtime_coefs; // per-thread scratch
+  if(N==0) runtime_coefs.resize(n*n);
+  double* coefs = (N>0) ? fixed_coefs : &runtime_coefs[0];
+  coefs[0] = 1;
+  for(int kl=1;kl<n*n;kl++) coefs[kl] = Params[first_hermite_param_index+kl-1];
+  
+  for(int c=0;c<ncols;c++) {
+    double* xt = x_terms+c;
+    const double* px = &Px[c*n];
+    for(int l=0;l<n;l++) {
+      const double* cl = coefs+l*n;
+      double q=0;
+      for(int k=0;k<n;k++) q += cl[k]*px[k];
+      xt[l*ncols] = q;
+    }
+    if(!with_derivatives) continue;
+    const double* pxds = &dPxds[c*n];
+    const double* pxdc = &dPxdc[c*n];
+    for(int l=0;l<n;l++) {
+      const double* cl = coefs+l*n;
+      double qds=0, qdc=0;
+      for(int k=0;k<n;k++) {
+	qds += cl[k]*pxds[k];
+	qdc += cl[k]*pxdc[k];
+      }
+      xt[(n+l)*ncols]   = px[l];
+      xt[(2*n+l)*ncols] = qds;
+      xt[(3*n+l)*ncols] = qdc;
+    }
+  }
+}
+
+template<int N> static double gauss_hermite_pix_value_from_stamp_cache(const int runtime_n, const specex::PSFStampCache& cache,
+								       const int IPix, const int JPix,
+								       unbls::vector_double *PosDer, unbls::vector_double *ParamDer) {
+  const int n = (N>0) ? N : runtime_n;
+  const int ncols = cache.end_i-cache.begin_i;
+  const double* xt = &cache.x_terms[IPix-cache.begin_i]; // stride ncols
+  const double* yt = &cache.y_terms[(JPix-cache.begin_j)*cache.ny_terms];
+  
+  double psfval = 0;
+  for(int l=0;l<n;l++) psfval += xt[l*ncols]*yt[l];
+  
+  if(ParamDer) {
+    // derivative wrt gauss-hermite coefficients
+    double* pd = &(*ParamDer)[2]; // first 2 params are sigmas
+    const double* px = xt+n*ncols;
+    for(int k=1;k<n;k++) pd[k-1] = px[k*ncols]*yt[0]; // skip (0,0)
+    pd += n-1;
+    for(int l=1;l<n;l++,pd+=n) {
+      const double yl = yt[l];
+      for(int k=0;k<n;k++) pd[k] = px[k*ncols]*yl;
+    }
+    // derivatives wrt sigmax and sigmay
+    double dsx=0, dsy=0;
+    for(int l=0;l<n;l++) {
+      dsx += xt[(2*n+l)*ncols]*yt[l];
+      dsy += xt[l*ncols]*yt[n+l];
+    }
+    (*ParamDer)[0] = dsx;
+    (*ParamDer)[1] = dsy;
+  }
+  if(PosDer) {
+    // derivatives wrt x and y
+    double dx=0, dy=0;
+    for(int l=0;l<n;l++) {
+      dx += xt[(3*n+l)*ncols]*yt[l];
+      dy += xt[l*ncols]*yt[2*n+l];
+    }
+    (*PosDer)[0] = dx;
+    (*PosDer)[1] = dy;
+  }
+  
+  return psfval;
+}
+
+template<int N> static void gauss_hermite_row_values_from_stamp_cache(const int runtime_n, const specex::PSFStampCache& cache,
+								      const int JPix, double* values) {
+  
+  // values(i) = sum_l Qx_l(i)*Pl(j) : a short sequence of axpy on contiguous rows of the cache
+  const int n = (N>0) ? N : runtime_n;
+  const int ncols = cache.end_i-cache.begin_i;
+  const double* __restrict__ q  = &cache.x_terms[0];
+  const double* yt = &cache.y_terms[(JPix-cache.begin_j)*cache.ny_terms];
+  double* __restrict__ v = values;
+  
+  const double y0 = yt[0];
+#pragma omp simd
+  for(int c=0;c<ncols;c++) v[c] = y0*q[c];
+  
+  for(int l=1;l<n;l++) {
+    const double yl = yt[l];
+    const double* __restrict__ ql = q+l*ncols;
+#pragma omp simd
+    for(int c=0;c<ncols;c++) v[c] += yl*ql[c];
+  }
+}
+
+// dispatch table, indexed by degree
+#define GAUSS_HERMITE_MIN_SPECIALIZED_DEGREE 3
+#define GAUSS_HERMITE_MAX_SPECIALIZED_DEGREE 8
+
+static const specex::GaussHermitePSF::Kernels gauss_hermite_kernels_of_degree[] = {
+#define GAUSS_HERMITE_KERNELS(N) {gauss_hermite_contract_columns<N>,gauss_hermite_pix_value_from_stamp_cache<N>,gauss_hermite_row_values_from_stamp_cache<N>}
+  GAUSS_HERMITE_KERNELS(4), // degree 3
+  GAUSS_HERMITE_KERNELS(5),
+  GAUSS_HERMITE_KERNELS(6),
+  GAUSS_HERMITE_KERNELS(7),
+  GAUSS_HERMITE_KERNELS(8),
+  GAUSS_HERMITE_KERNELS(9)  // degree 8
+#undef GAUSS_HERMITE_KERNELS
+};
+
+static const specex::GaussHermitePSF::Kernels gauss_hermite_generic_kernels = 
+  {gauss_hermite_contract_columns<0>,gauss_hermite_pix_value_from_stamp_cache<0>,gauss_hermite_row_values_from_stamp_cache<0>};
+
+void specex::GaussHermitePSF::SetKernels() {
+  if(degree>=GAUSS_HERMITE_MIN_SPECIALIZED_DEGREE && degree<=GAUSS_HERMITE_MAX_SPECIALIZED_DEGREE)
+    kernels = gauss_hermite_kernels_of_degree[degree-GAUSS_HERMITE_MIN_SPECIALIZED_DEGREE];
+  else
+    kernels = gauss_hermite_generic_kernels;
+}
+
+bool specex::GaussHermitePSF::PrepareStampCache(const double &Xc, const double &Yc,
+						const int begin_i, const int end_i, const int begin_j, const int end_j,
+						const unbls::vector_double &Params, bool with_derivatives,
+						specex::PSFStampCache& cache) const {
+  
+  if(end_i<=begin_i || end_j<=begin_j) {cache.clear(); return true;}
+  
+  double sx = Params[0];
+  double sy = Params[1];
+  if(sx<0.1) {sx=0.1;} // to avoid failures in exploration of model params
+  if(sy<0.1) {sy=0.1;} // to avoid failures in exploration of model params
+  
+  const int n  = degree+1;
+  const int ncols = end_i-begin_i;
+  const int nrows = end_j-begin_j;
+  
+  cache.begin_i = begin_i;
+  cache.end_i   = end_i;
+  cache.begin_j = begin_j;
+  cache.end_j   = end_j;
+  cache.with_derivatives = with_derivatives;
+  cache.nx_terms = (with_derivatives) ? 4*n : n;
+  cache.ny_terms = (with_derivatives) ? 3*n : n;
+  cache.x_terms.resize(ncols*cache.nx_terms);
+  cache.y_terms.resize(nrows*cache.ny_terms);
+  
+  thread_local unbls::vector_double Px,dPxds,dPxdc; // per-thread scratch
+  gauss_hermite_1d_pixel_integrals(Xc,sx,n,begin_i,end_i,with_derivatives,Px,dPxds,dPxdc);
+  
+  thread_local unbls::vector_double Py,dPyds,dPydc;
+  gauss_hermite_1d_pixel_integrals(Yc,sy,n,begin_j,end_j,with_derivatives,Py,dPyds,dPydc);
+  
+  // columns : contraction with coefficients
+  kernels.contract_columns(n,ncols,Params,with_derivatives,Px,dPxds,dPxdc,&cache.x_terms[0]);
+  
+  // rows
+  for(int r=0;r<nrows;r++) {
+    double* yt = &cache.y_terms[r*cache.ny_terms];
+    for(int l=0;l<n;l++) {
+      yt[l] = Py[r*n+l];
+      if(with_derivatives) {
+	yt[n+l]   = dPyds[r*n+l];
+	yt[2*n+l] = dPydc[r*n+l];
+      }
+    }
+  }
+  
+  return true;
+}
+
+double specex::GaussHermitePSF::PixValueFromStampCache(const specex::PSFStampCache& cache,
+						       const int IPix, const int JPix,
+						       const unbls::vector_double &Params,
+						       unbls::vector_double *PosDer,
+						       unbls::vector_double *ParamDer) const {
+  return kernels.pix_value_from_stamp_cache(degree+1,cache,IPix,JPix,PosDer,ParamDer);
+}
+
+void specex::GaussHermitePSF::RowValuesFromStampCache(const specex::PSFStampCache& cache,
+						      const int JPix,
+						      const unbls::vector_double &Params,
+						      double* values) const {
+  kernels.row_values_from_stamp_cache(degree+1,cache,JPix,values);
+}
+
 int specex::GaussHermitePSF::LocalNAllPar() const {
     
   int npar = 2; // sigma_x and sigma_y
@@ -448,8 +753,19 @@ void specex::GaussHermitePSF::Append(const specex::PSF_p other_p) {
     SPECEX_INFO("Appending parameters of bundle " << it->first);
     ParamsOfBundles[it->first] = it->second;
   }
+  CompileParamLayout();
 
   
   SPECEX_INFO("GaussHermitePSF::Append successful");
   
 }
+
+specex::PSF_p specex::GaussHermitePSF::Clone() const {
+  specex::GaussHermitePSF* clone = new specex::GaussHermitePSF(*this);
+  // XPol, YPol and the snapshot point to the traces of this PSF, XPol and YPol are reloaded on demand
+  clone->XPol.clear();
+  clone->YPol.clear();
+  clone->Unfreeze();
+  clone->snapshot = specex::PSFEvaluationSnapshot();
+  return specex::PSF_p(clone);
+}
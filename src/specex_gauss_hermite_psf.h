@@ -11,8 +11,22 @@ namespace specex {
 
   class GaussHermitePSF : public PSF {
 
+  public :
+    
+    // kernels specialized for the degree, see SetDegree
+    struct Kernels {
+      void (*contract_columns)(const int n, const int ncols, const unbls::vector_double &Params, bool with_derivatives,
+			       const unbls::vector_double& Px, const unbls::vector_double& dPxds, const unbls::vector_double& dPxdc,
+			       double* x_terms);
+      double (*pix_value_from_stamp_cache)(const int n, const PSFStampCache& cache, const int IPix, const int JPix,
+					   unbls::vector_double *PosDer, unbls::vector_double *ParamDer);
+      void (*row_values_from_stamp_cache)(const int n, const PSFStampCache& cache, const int JPix, double* values);
+    };
+    
   protected :
     int degree;
+    Kernels kernels;
+    void SetKernels();
     
   public :
 
@@ -41,6 +55,23 @@ namespace specex {
 				     unbls::vector_double *PosDer,
 				 unbls::vector_double *ParamDer) const;
     
+    // separable evaluation of PixValue on a stamp
+    bool PrepareStampCache(const double &Xc, const double &Yc,
+			   const int begin_i, const int end_i, const int begin_j, const int end_j,
+			   const unbls::vector_double &Params, bool with_derivatives,
+			   PSFStampCache& cache) const;
+    
+    double PixValueFromStampCache(const PSFStampCache& cache,
+				  const int IPix, const int JPix,
+				  const unbls::vector_double &Params,
+				  unbls::vector_double *PosDer,
+				  unbls::vector_double *ParamDer) const;
+    
+    void RowValuesFromStampCache(const PSFStampCache& cache,
+				 const int JPix,
+				 const unbls::vector_double &Params,
+				 double* values) const;
+    
     unbls::vector_double DefaultParams() const;
     std::vector<std::string> DefaultParamNames() const;
     
@@ -48,6 +79,7 @@ namespace specex {
     { return true;}
     
     void Append(const specex::PSF_p other);
+    specex::PSF_p Clone() const;
  
   };
   
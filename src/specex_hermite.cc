@@ -29,7 +29,17 @@ double specex::HermitePol(const int Degree, const double &x) {
 	H10(x)=x^{10}-45x^8+630x^6-3150x^4+4725x^2-945 
       */    
     default : 
-      return x*HermitePol(Degree-1,x)-(Degree-1)*HermitePol(Degree-2,x);
+      {
+	// forward recurrence from H5 and H6
+	double hm1 = x*x*x*(x*x-10)+15*x;
+	double h   = -15+x*x*(45+x*x*(-15+x*x));
+	for(int d=7;d<=Degree;d++) {
+	  double hp1 = x*h-(d-1)*hm1;
+	  hm1 = h;
+	  h = hp1;
+	}
+	return h;
+      }
     }
   
 }
@@ -39,3 +49,24 @@ double specex::HermitePolDerivative(const int Degree, const double &x) {
   return Degree*HermitePol(Degree-1,x);
 }
 
+
+void specex::HermitePols(const int Degree, const double &x, double* H, double* dH) {
+  // H_{n+1} = x H_n - n H_{n-1} , H_n' = n H_{n-1}
+  H[0] = 1;
+  if(dH) dH[0] = 0;
+  if(Degree<1) return;
+  H[1] = x;
+  if(dH) dH[1] = 1;
+  for(int d=2;d<=Degree;d++) {
+    H[d] = x*H[d-1]-(d-1)*H[d-2];
+    if(dH) dH[d] = d*H[d-1];
+  }
+}
+
+void specex::HermitePols(const int Degree, const unbls::vector_double &x, unbls::vector_double& H, unbls::vector_double* dH) {
+  const int n = Degree+1;
+  H.resize(x.size()*n);
+  if(dH) dH->resize(x.size()*n);
+  for(size_t k=0;k<x.size();k++)
+    HermitePols(Degree,x[k],&H[k*n],(dH) ? &(*dH)[k*n] : 0);
+}
@@ -6,6 +6,11 @@
 namespace specex {
   double HermitePol(const int Degree, const double &x);
   double HermitePolDerivative(const int Degree, const double &x);
+  
+  // all polynomials H_0..H_Degree (and their derivatives if dH!=0) at x, with one forward recurrence
+  void HermitePols(const int Degree, const double &x, double* H, double* dH=0);
+  // same for each x[k], results in H[k*(Degree+1)+d]
+  void HermitePols(const int Degree, const unbls::vector_double &x, unbls::vector_double& H, unbls::vector_double* dH=0);
 }
 
 #endif
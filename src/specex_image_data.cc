@@ -15,6 +15,8 @@ specex::image_data::image_data() :
 {
  rows_=0;
  cols_=0;
+ begin_i_=0;
+ begin_j_=0;
 }
 
 specex::image_data::image_data(size_t ncols, size_t nrows) : 
@@ -31,12 +33,16 @@ specex::image_data::image_data(size_t ncols, size_t nrows, const unbls::vector_d
 }
 
 void specex::image_data::resize(size_t ncols, size_t nrows) {
+  begin_i_ = 0;
+  begin_j_ = 0;
   rows_ = nrows;
   cols_ = ncols;
   data.resize(rows_*cols_);
   unbls::zero(data);
 }
 
-
-
-
+void specex::image_data::resize_window(int begin_i, int end_i, int begin_j, int end_j) {
+  resize(max(0,end_i-begin_i),max(0,end_j-begin_j));
+  begin_i_ = begin_i;
+  begin_j_ = begin_j;
+}
@@ -12,6 +12,8 @@ namespace specex {
   protected :
     size_t rows_;
     size_t cols_;
+    int begin_i_; // coordinates of the first pixel, non zero for a window of a larger image
+    int begin_j_;
     
   public :
 
@@ -21,29 +23,39 @@ namespace specex {
     image_data ( size_t ncols, size_t nrows);
     image_data ( size_t ncols, size_t nrows, const unbls::vector_double& i_data);
     void resize( size_t ncols, size_t nrows); 
+    //! resize to the window [begin_i,end_i[x[begin_j,end_j[ of a larger image, whose pixels
+    //! are then indexed with the coordinates of the larger image. the storage is reused.
+    void resize_window( int begin_i, int end_i, int begin_j, int end_j);
     size_t n_rows ( ) const { return rows_; }
     size_t n_cols ( ) const { return cols_; }
     void values ( unbls::vector_double & i_data ) const {i_data=data;}
     size_t Ny ( ) const { return rows_; }
     size_t Nx ( ) const { return cols_; }
+    int begin_i ( ) const { return begin_i_; }
+    int begin_j ( ) const { return begin_j_; }
+    int end_i ( ) const { return begin_i_+int(cols_); }
+    int end_j ( ) const { return begin_j_+int(rows_); }
+    bool contains ( const int i, const int j) const {
+      return (i>=begin_i_ && i<begin_i_+int(cols_) && j>=begin_j_ && j<begin_j_+int(rows_));
+    }
     
     
     inline double& operator()(const int i, const int j) {
 #ifdef CHECK_BOUNDS
-      if (i<0 || i>=cols_ || j<0 || j>=rows_)
+      if (!contains(i,j))
 	SPECEX_ERROR("Out of range");
 #endif
-      return data[i+j*cols_]; // "STANDARD" PACKING (FITSIO)      
+      return data[(i-begin_i_)+(j-begin_j_)*cols_]; // "STANDARD" PACKING (FITSIO)      
       
     }
     
     inline const double& operator()(const int i, const int j) const {
 #ifdef CHECK_BOUNDS
-      if (i<0 || i>=cols_ || j<0 || j>=rows_)
+      if (!contains(i,j))
 	SPECEX_ERROR("Out of range");
 #endif
       
-      return data[i+j*cols_];// "STANDARD" PACKING (FITSIO)
+      return data[(i-begin_i_)+(j-begin_j_)*cols_];// "STANDARD" PACKING (FITSIO)
       
     }
 
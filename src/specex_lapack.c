@@ -14,6 +14,24 @@ int specex_posv(int n, const double *A, const double *b){
   return LAPACKE_dposv(LAPACK_COL_MAJOR, 'L', n, 1, A, n, b, n);  
 }
 
+// cholesky decomposition A = L*L**T, L is returned in the lower half of A
+// http://www.netlib.org/lapack/explore-html/d0/d8a/dpotrf_8f_source.html
+int specex_potrf(int n, const double *A){
+  return LAPACKE_dpotrf(LAPACK_COL_MAJOR, 'L', n, A, n);  
+}
+
+// solves A * X = B with A = L*L**T from specex_potrf, B (n x nrhs) --> X
+// http://www.netlib.org/lapack/explore-html/d8/d67/dpotrs_8f_source.html
+int specex_potrs(int n, int nrhs, const double *A, const double *B){
+  return LAPACKE_dpotrs(LAPACK_COL_MAJOR, 'L', n, nrhs, A, n, B, n);  
+}
+
+// solves L * X = B with L lower triangular, B (n x nrhs) --> X
+// http://www.netlib.org/lapack/explore-html/d6/d6f/dtrtrs_8f_source.html
+int specex_trtrs(int n, int nrhs, const double *A, const double *B){
+  return LAPACKE_dtrtrs(LAPACK_COL_MAJOR, 'L', 'N', 'N', n, nrhs, A, n, B, n);  
+}
+
 // invert matrix A in place; A := inv(A)
 // http://www.netlib.org/lapack/explore-html/d8/d63/dpotri_8f_source.html
 int specex_potri(int n, const double *A){
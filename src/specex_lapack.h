@@ -4,6 +4,9 @@
 extern "C" {
   int specex_posv(int, const double *, const double *);
   int specex_potri(int, const double *);  
+  int specex_potrf(int, const double *);  
+  int specex_potrs(int, int, const double *, const double *);  
+  int specex_trtrs(int, int, const double *, const double *);  
 }
 
 #endif
@@ -6,27 +6,28 @@
 #include "specex_message.h"
 #include "specex_fits.h" // for debugging
 
-//! base of (not-normalized) Legendre polynomials
-static double LegendrePol(const int Degree, const double &X)
+//! base of (not-normalized) Legendre polynomials, all degrees 0 to Degree at once, with the recurrence
+//! (n+1) P_n+1 = (2n+1) X P_n - n P_n-1
+static inline void LegendrePols(const int Degree, const double &X, double* P)
 {
-  switch (Degree)
-    {
-    case 0: return 1; break;
-    case 1: return X; break;
-    case 2: return 0.5*(3*X*X-1.); break;
-    case 3: return 0.5*(5*X*X-3)*X; break;
-    case 4: return 0.125*((35*X*X-30)*X*X+3); break;
-    case 5: return 0.125*(((63*X*X-70)*X*X+15)*X); break;
-    case 6: return (((231*X*X-315)*X*X+105)*X*X-5)/16.; break;
-    default : 
-      return ((2*Degree-1)*X*LegendrePol(Degree-1, X) - 
-	      (Degree-1)*LegendrePol(Degree-2, X))/double(Degree);
-      /*
-      FatalError(" consider implementing Legendre pol of abitrary degree");
-      return 1; 
-      */
-      break;
-    }
+  P[0] = 1;
+  if(Degree<1) return;
+  P[1] = X;
+  for(int n=2;n<=Degree;n++)
+    P[n] = ((2*n-1)*X*P[n-1] - (n-1)*P[n-2])/double(n);
+}
+
+//! sum_n Coeff[n] P_n(X) with the Clenshaw algorithm
+static inline double LegendreSum(const int Degree, const double* Coeff, const double &X)
+{
+  double b1 = 0; // b_k+1
+  double b2 = 0; // b_k+2
+  for(int k=Degree;k>=1;k--) {
+    double b = Coeff[k] + (2*k+1)*X*b1/double(k+1) - (k+1)*b2/double(k+2);
+    b2 = b1;
+    b1 = b;
+  }
+  return Coeff[0] + X*b1 - 0.5*b2;
 }
 
 
@@ -43,19 +44,52 @@ specex::Legendre1DPol::Legendre1DPol(int i_deg, const double& i_xmin, const doub
 
 
 unbls::vector_double specex::Legendre1DPol::Monomials(const double &x) const {
+  unbls::vector_double m(deg+1);
+  Monomials(x,m);
+  return m;
+}
+
+void specex::Legendre1DPol::Monomials(const double &x, unbls::vector_double& m) const {
 
   // range is -1,1 if  xmin<x<xmax
   double rx= 2*(x-xmin)/(xmax-xmin)-1;
-  unbls::vector_double m(deg+1);
-  for(int i=0;i<=deg;i++) {
-    m[i]=LegendrePol(i,rx);
-  }
-  return m;
+  m.resize(deg+1);
+  LegendrePols(deg,rx,&m[0]);
 }
 
 
 double specex::Legendre1DPol::Value(const double &x) const {
-  return specex::dot(coeff,Monomials(x));
+  if(coeff.size()==0) return 0;
+  double rx= 2*(x-xmin)/(xmax-xmin)-1;
+  return LegendreSum(int(coeff.size())-1,&coeff[0],rx);
+}
+
+void specex::Legendre1DPol::Values(const unbls::vector_double& x, unbls::vector_double& values) const {
+  
+  // Clenshaw recurrence run on all x at once, the inner loops on x vectorize
+  size_t n = x.size();
+  values.resize(n);
+  if(n==0) return;
+  if(coeff.size()==0) {unbls::zero(values); return;}
+  int d = int(coeff.size())-1;
+  unbls::vector_double rx(n);
+  unbls::vector_double b2(n,0.); // b_k+2
+  for(size_t p=0;p<n;p++) {
+    rx[p] = 2*(x[p]-xmin)/(xmax-xmin)-1;
+    values[p] = 0; // b_k+1
+  }
+  for(int k=d;k>=1;k--) {
+    double ck = coeff[k];
+    double ak = (2*k+1)/double(k+1);
+    double bk = (k+1)/double(k+2);
+    for(size_t p=0;p<n;p++) {
+      double b = ck + ak*rx[p]*values[p] - bk*b2[p];
+      b2[p] = values[p];
+      values[p] = b;
+    }
+  }
+  for(size_t p=0;p<n;p++)
+    values[p] = coeff[0] + rx[p]*values[p] - 0.5*b2[p];
 }
 
 bool specex::Legendre1DPol::Fit(const unbls::vector_double& X, const unbls::vector_double& Y, const unbls::vector_double* Yerr, bool set_range) {
@@ -120,8 +154,8 @@ specex::Legendre1DPol specex::Legendre1DPol::Invert(int add_degree) const {
   unbls::vector_double Y(ndata);
   for(int i=0;i<ndata;i++) {
     X[i] = xmin+i*dx;
-    Y[i] = Value(X[i]);
   }
+  Values(X,Y);
   bool ok = inverse.Fit(Y,X,0,true);
   if(!ok) abort();
   return inverse;
@@ -149,29 +183,45 @@ void specex::Legendre2DPol::Fill() {
 }
  
 unbls::vector_double specex::Legendre2DPol::Monomials(const double &x, const double &y) const {
+  unbls::vector_double m((xdeg+1)*(ydeg+1));
+  Monomials(x,y,m);
+  return m;
+}
+
+void specex::Legendre2DPol::Monomials(const double &x, const double &y, unbls::vector_double& m) const {
   
   // range is -1,1 if  xmin<x<xmax
   double rx= 2*(x-xmin)/(xmax-xmin)-1;
   double ry= 2*(y-ymin)/(ymax-ymin)-1;
   
-  unbls::vector_double mx(xdeg+1,0.0);
-  for(int i=0;i<=xdeg;i++)
-    mx[i]=LegendrePol(i,rx);
+  m.resize((xdeg+1)*(ydeg+1));
+  thread_local unbls::vector_double my; // per-thread scratch
+  my.resize(ydeg+1);
+  LegendrePols(xdeg,rx,&m[0]);
+  LegendrePols(ydeg,ry,&my[0]);
   
-  unbls::vector_double m((xdeg+1)*(ydeg+1));
-  int index=0;
-  for(int j=0;j<=ydeg;j++) {
-    double myj = LegendrePol(j,ry);
-    for(int i=0;i<=xdeg;i++,index++) {
-      m[index]=mx[i]*myj;
+  // fill from the last row so that the first one (the x monomials) is used before being overwritten
+  for(int j=ydeg;j>=0;j--) {
+    double myj = my[j];
+    for(int i=0;i<=xdeg;i++) {
+      m[i+j*(xdeg+1)]=m[i]*myj;
     }
   }
-  return m;
 }
 
 
 double specex::Legendre2DPol::Value(const double &x,const double &y) const {
-  return specex::dot(coeff,Monomials(x,y));
+  
+  // range is -1,1 if  xmin<x<xmax
+  double rx= 2*(x-xmin)/(xmax-xmin)-1;
+  double ry= 2*(y-ymin)/(ymax-ymin)-1;
+  
+  // sum over x of each row of coefficients, then over y
+  thread_local unbls::vector_double cy; // per-thread scratch
+  cy.resize(ydeg+1);
+  for(int j=0;j<=ydeg;j++)
+    cy[j] = LegendreSum(xdeg,&coeff[j*(xdeg+1)],rx);
+  return LegendreSum(ydeg,&cy[0],ry);
 }
 
 //============================
@@ -232,25 +282,69 @@ void specex::SparseLegendre2DPol::Clear() {
   coeff.resize(0);
 }
 
+bool specex::SparseLegendre2DPol::SameBasis(const specex::SparseLegendre2DPol& other) const {
+  return (xdeg==other.xdeg && ydeg==other.ydeg 
+	  && xmin==other.xmin && xmax==other.xmax && ymin==other.ymin && ymax==other.ymax
+	  && non_zero_indices==other.non_zero_indices);
+}
+
 
 unbls::vector_double specex::SparseLegendre2DPol::Monomials(const double &x, const double &y) const {
+  unbls::vector_double m(non_zero_indices.size(),0.0);
+  Monomials(x,y,m);
+  return m;
+}
+
+void specex::SparseLegendre2DPol::Monomials(const double &x, const double &y, unbls::vector_double& m) const {
   
   // range is -1,1 if  xmin<x<xmax
   double rx= 2*(x-xmin)/(xmax-xmin)-1;
   double ry= 2*(y-ymin)/(ymax-ymin)-1;  
   
-  unbls::vector_double m(non_zero_indices.size(),0.0);
+  m.resize(non_zero_indices.size());
+  
+  // the 1D Legendre polynomials are computed once and shared by all the non zero indices
+  thread_local unbls::vector_double mx; // per-thread scratch
+  thread_local unbls::vector_double my;
+  mx.resize(xdeg+1);
+  my.resize(ydeg+1);
+  LegendrePols(xdeg,rx,&mx[0]);
+  LegendrePols(ydeg,ry,&my[0]);
+  
   int index=0;
   for(std::vector<int>::const_iterator k = non_zero_indices.begin(); k!=  non_zero_indices.end(); k++, index++) {
     int i = (*k)%(xdeg+1);
     int j = (*k)/(xdeg+1);
-    m[index]=LegendrePol(i,rx)*LegendrePol(j,ry);
+    m[index]=mx[i]*my[j];
   }
-  return m;
 }
 
 
 double specex::SparseLegendre2DPol::Value(const double &x,const double &y) const {
-  return specex::dot(coeff,Monomials(x,y));
+  
+  // range is -1,1 if  xmin<x<xmax
+  double rx= 2*(x-xmin)/(xmax-xmin)-1;
+  double ry= 2*(y-ymin)/(ymax-ymin)-1;  
+  
+  thread_local unbls::vector_double mx; // per-thread scratch
+  thread_local unbls::vector_double my;
+  mx.resize(xdeg+1);
+  my.resize(ydeg+1);
+  LegendrePols(xdeg,rx,&mx[0]);
+  LegendrePols(ydeg,ry,&my[0]);
+  
+  double val = 0;
+  int index=0;
+  for(std::vector<int>::const_iterator k = non_zero_indices.begin(); k!=  non_zero_indices.end(); k++, index++)
+    val += coeff[index]*mx[(*k)%(xdeg+1)]*my[(*k)/(xdeg+1)];
+  return val;
+}
+
+void specex::SparseLegendre2DPol::Values(const unbls::vector_double& x, const unbls::vector_double& y, unbls::vector_double& values) const {
+  
+  if(x.size() != y.size()) SPECEX_ERROR("SparseLegendre2DPol::Values, not same size x:" << x.size() << " y:" << y.size());
+  values.resize(x.size());
+  for(size_t p=0;p<x.size();p++)
+    values[p] = Value(x[p],y[p]);
 }
 
@@ -20,7 +20,9 @@ class Legendre1DPol
   Legendre1DPol(int i_deg=0, const double& i_xmin=0, const double& i_xmax=0);
   
   unbls::vector_double Monomials(const double &x) const;
+  void Monomials(const double &x, unbls::vector_double& m) const; // no allocation if m has the right size
   double Value(const double &x) const;
+  void Values(const unbls::vector_double& x, unbls::vector_double& values) const; // Value of all x
   
   bool Fit(const unbls::vector_double& x, const unbls::vector_double& y, const unbls::vector_double* ey=0, bool set_range = true);
   Legendre1DPol Invert(int add_degree=0) const;
@@ -42,6 +44,7 @@ class Legendre2DPol
 	       int i_ydeg=0, const double& i_ymin=0, const double& i_ymax=0);
  
   unbls::vector_double Monomials(const double &x,const double &y) const;
+  void Monomials(const double &x,const double &y, unbls::vector_double& m) const; // no allocation if m has the right size
   double Value(const double &x,const double &y) const;
   void Fill();
 
@@ -62,12 +65,15 @@ class SparseLegendre2DPol
   void Add(int i,int j);
   void Fill(bool sparse = true); // this is equivalent to a std Legendre2DPol is sparse=false
   void Clear(); // reset
+  bool SameBasis(const SparseLegendre2DPol& other) const; // same degrees, ranges and non zero indices
 
   SparseLegendre2DPol(int i_xdeg=0, const double& i_xmin=0, const double& i_xmax=0, 
 		      int i_ydeg=0, const double& i_ymin=0, const double& i_ymax=0);
   
   unbls::vector_double Monomials(const double &x,const double &y) const;
+  void Monomials(const double &x,const double &y, unbls::vector_double& m) const; // no allocation if m has the right size
   double Value(const double &x,const double &y) const;
+  void Values(const unbls::vector_double& x, const unbls::vector_double& y, unbls::vector_double& values) const; // Value of all (x,y)
  
 };
 
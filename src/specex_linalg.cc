@@ -41,6 +41,13 @@ void specex::syrk(const double& alpha, const unbls::matrix_double &A, const doub
   specex_syrk(Asize1, Asize2, &alpha, &A(0,0), &beta, &C(0,0));
 }
 
+// C = alpha*A**T*A + beta*C
+void specex::syrk_transposed(const double& alpha, const unbls::matrix_double &A, const double& beta, unbls::matrix_double &C) {
+  int Asize1 = A.size1();
+  int Asize2 = A.size2();
+  specex_syrk_t(Asize2, Asize1, &alpha, &A(0,0), &beta, &C(0,0));
+}
+
 // y = alpha*A*x + beta*y 
 void specex::gemv(const double &alpha,  const unbls::matrix_double &A,  const unbls::vector_double& x, const double &beta, unbls::vector_double& y) {  
   int Asize1 = A.size1();
@@ -72,6 +79,30 @@ int specex::cholesky_invert_after_decomposition(unbls::matrix_double& A) {
   return specex_potri(Asize1,&A(0,0));
 }
 
+// cholesky decomposition in place, A := L with A = L*L**T
+int specex::cholesky_decompose(unbls::matrix_double& A) {
+  int Asize1 = A.size1();
+  return specex_potrf(Asize1,&A(0,0));
+}
+
+// b := inv(A)*b, after cholesky_decompose(A)
+int specex::cholesky_solve_after_decomposition(const unbls::matrix_double& A, unbls::vector_double& b) {
+  int Asize1 = A.size1();
+  return specex_potrs(Asize1,1,&A(0,0),&b[0]);
+}
+int specex::cholesky_solve_after_decomposition(const unbls::matrix_double& A, unbls::matrix_double& B) {
+  int Asize1 = A.size1();
+  int Bsize2 = B.size2();
+  return specex_potrs(Asize1,Bsize2,&A(0,0),&B(0,0));
+}
+
+// B := inv(L)*B, L lower triangular
+int specex::triangular_solve(const unbls::matrix_double& L, unbls::matrix_double& B) {
+  int Lsize1 = L.size1();
+  int Bsize2 = B.size2();
+  return specex_trtrs(Lsize1,Bsize2,&L(0,0),&B(0,0));
+}
+
 // min and max of vector
 void specex::minmax(const unbls::vector_double& v, double& minv, double& maxv) {
   unbls::vector_double::const_iterator it=v.begin();
@@ -26,6 +26,9 @@ namespace specex {
   // ! C = alpha*A*At + beta*C
   void syrk(const double& alpha, const unbls::matrix_double &A, const double& beta, unbls::matrix_double &C);
 
+  // ! C = alpha*At*A + beta*C
+  void syrk_transposed(const double& alpha, const unbls::matrix_double &A, const double& beta, unbls::matrix_double &C);
+
   // return min and max of vector
   void minmax(const unbls::vector_double& v, double& minv, double& maxv);
   
@@ -36,6 +39,16 @@ namespace specex {
   
   // ! assumes A has been through cholesky_solve before
   int cholesky_invert_after_decomposition(unbls::matrix_double& A);
+
+  // ! A := L with A = L*Lt (lower half)
+  int cholesky_decompose(unbls::matrix_double& A);
+  
+  // ! B := inv(A)*B, assumes A has been through cholesky_decompose before
+  int cholesky_solve_after_decomposition(const unbls::matrix_double& A, unbls::vector_double& B);
+  int cholesky_solve_after_decomposition(const unbls::matrix_double& A, unbls::matrix_double& B);
+  
+  // ! B := inv(L)*B, L lower triangular
+  int triangular_solve(const unbls::matrix_double& L, unbls::matrix_double& B);
   
 }
 #endif
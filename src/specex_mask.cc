@@ -22,10 +22,10 @@ void specex::Mask::ApplyMaskToImage(specex::image_data& img, const specex::PSF&
       int i2 = int(it->second.X_vs_W.Value(inter.max));
       int j2 = int(it->second.Y_vs_W.Value(inter.max));
       
-      int imin = max(0,min(i1,i2)-hsize);
-      int imax = min(int(img.Nx())-1,max(i1,i2)+hsize);
-      int jmin = max(0,min(j1,j2));
-      int jmax = min(int(img.Ny())-1,max(j1,j2));
+      int imin = max(img.begin_i(),min(i1,i2)-hsize);
+      int imax = min(img.end_i()-1,max(i1,i2)+hsize);
+      int jmin = max(img.begin_j(),min(j1,j2));
+      int jmax = min(img.end_j()-1,max(j1,j2));
       
       
       //if(it==PSF.FiberTraces.begin()) {
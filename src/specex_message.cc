@@ -3,13 +3,16 @@
 static bool static_specex_debug = false; 
 static bool static_specex_verbose = false; 
 static bool static_specex_dump_core = false; 
+static thread_local bool static_specex_thread_quiet = false; 
 
 void specex_set_debug(bool yesorno) { static_specex_debug=yesorno;}
 void specex_set_verbose(bool yesorno) { static_specex_verbose=yesorno;}
 void specex_set_dump_core(bool yesorno) { static_specex_dump_core=yesorno;}
+void specex_set_thread_quiet(bool yesorno) { static_specex_thread_quiet=yesorno;}
+bool specex_is_thread_quiet() {return static_specex_thread_quiet;}
 bool specex_dump_core() {return static_specex_dump_core;}
-bool specex_is_verbose() {return static_specex_verbose;}
-bool specex_is_debug() {return static_specex_debug;}
+bool specex_is_verbose() {return static_specex_verbose && !static_specex_thread_quiet;}
+bool specex_is_debug() {return static_specex_debug && !static_specex_thread_quiet;}
 
 
 void specex_debug(const std::string& mess) {
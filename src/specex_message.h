@@ -10,6 +10,8 @@
 void specex_set_debug(bool yesorno);
 void specex_set_verbose(bool yesorno);
 void specex_set_dump_core(bool yesorno);
+void specex_set_thread_quiet(bool yesorno); // turns off debug and info messages of the calling thread only
+bool specex_is_thread_quiet();
 bool specex_is_verbose();
 bool specex_is_debug();
 bool specex_dump_core();
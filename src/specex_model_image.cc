@@ -21,20 +21,20 @@ specex::Stamp specex::compute_stamp(const specex::image_data& model_image, const
 
     Stamp stamp(model_image);
     psf->StampLimits(spot->xc,spot->yc,stamp.begin_i,stamp.end_i,stamp.begin_j,stamp.end_j);
-    stamp.begin_i = max(0,stamp.begin_i);
-    stamp.end_i   = min(stamp.Parent_n_cols(),stamp.end_i);
-    stamp.begin_j = max(0,stamp.begin_j);
-    stamp.end_j   = min(stamp.Parent_n_rows(),stamp.end_j);
+    stamp.begin_i = max(model_image.begin_i(),stamp.begin_i);
+    stamp.end_i   = min(model_image.end_i(),stamp.end_i);
+    stamp.begin_j = max(model_image.begin_j(),stamp.begin_j);
+    stamp.end_j   = min(model_image.end_j(),stamp.end_j);
     
     global_stamp.begin_i = min(global_stamp.begin_i,stamp.begin_i-x_margin);
     global_stamp.end_i   = max(global_stamp.end_i,stamp.end_i+x_margin);
     global_stamp.begin_j = min(global_stamp.begin_j,stamp.begin_j-y_margin);
     global_stamp.end_j   = max(global_stamp.end_j,stamp.end_j+y_margin);
   }
-  global_stamp.begin_i = max(0,global_stamp.begin_i);
-  global_stamp.end_i = min(global_stamp.end_i,global_stamp.Parent_n_cols());
-  global_stamp.begin_j = max(0,global_stamp.begin_j);
-  global_stamp.end_j = min(global_stamp.end_j,global_stamp.Parent_n_rows());
+  global_stamp.begin_i = max(model_image.begin_i(),global_stamp.begin_i);
+  global_stamp.end_i = min(global_stamp.end_i,model_image.end_i());
+  global_stamp.begin_j = max(model_image.begin_j(),global_stamp.begin_j);
+  global_stamp.end_j = min(global_stamp.end_j,model_image.end_j());
   
 
   //SPECEX_INFO("stamp [" << global_stamp.begin_i << ":" << global_stamp.end_i << "," << global_stamp.begin_j << ":" << global_stamp.end_j << "]");
@@ -42,205 +42,294 @@ specex::Stamp specex::compute_stamp(const specex::image_data& model_image, const
   return global_stamp;
 }
 
-void specex::parallelized_compute_model_image(specex::image_data& model_image, const specex::image_data& weight, const specex::PSF_p psf, const std::vector<specex::Spot_p>& spots, bool only_on_spots, bool only_psf_core, bool only_positive, int x_margin, int y_margin, int only_this_bundle) {
+// a spot rendered by render_model_image
+struct RenderedSpot {
+  specex::Spot_p spot;
+  specex::Stamp stamp; // core stamp
+  int support_begin_i; // pixels where the spot is computed (core stamp, or tail support)
+  int support_end_i;
+  int support_begin_j;
+  int support_end_j;
+  bool has_tail;
+  bool only_core;
+  unbls::vector_double params;
+  specex::PSFStampCache stamp_cache; // psf core terms of the whole core stamp
+};
 
-  SPECEX_DEBUG("parallelized_compute_model_image");
-  
-  int number_of_image_chuncks = 1;
-  char* OMP_NUM_THREADS = getenv("OMP_NUM_THREADS");
-  if(OMP_NUM_THREADS) {
-    number_of_image_chuncks = atoi(OMP_NUM_THREADS);
-    SPECEX_DEBUG("Using " << number_of_image_chuncks << " image chunks equal to value of OMP_NUM_THREADS");
-  }
-
-#ifdef EXTERNAL_TAIL  
-  // precompute tail profile
-  psf->TailProfile(0,0,psf->AllLocalParamsFW(spots[0]->fiber,spots[0]->wavelength,spots[0]->fiber_bundle));
-#endif
-
-  //SPECEX_INFO("specex::parallelized_compute_model_image");
-  Stamp stamp = compute_stamp(model_image,psf,spots,x_margin,y_margin);
-  int step_j  = (stamp.end_j-stamp.begin_j)/number_of_image_chuncks;
-
-  unbls::zero(model_image.data);
-  
-  int chunk=0;
-  
-#pragma omp parallel for 
-  for(chunk=0; chunk<number_of_image_chuncks; chunk++) {
-
-    int begin_j = stamp.begin_j + chunk*step_j;
-    int end_j   = stamp.begin_j + (chunk+1)*step_j;
-    if(chunk==number_of_image_chuncks-1) end_j = stamp.end_j;
-    
-    if(end_j>begin_j)
-      compute_model_image(model_image,weight,psf,spots,only_on_spots,only_psf_core,only_positive,begin_j,end_j,x_margin,y_margin,only_this_bundle);
-  } 
-}
-
-
-
-void specex::compute_model_image(specex::image_data& model_image, const specex::image_data& weight, const specex::PSF_p psf, const std::vector<specex::Spot_p>& spots, bool only_on_spots, bool only_psf_core, bool only_positive, int predefined_begin_j, int predefined_end_j, int x_margin, int y_margin, int only_this_bundle) {
-  
+// model of the rows [begin_j,end_j[ of the image, see compute_model_image.
+// the spots are prepared once (psf parameters and core terms of their stamp), in parallel, then the rows are
+// divided in number_of_threads tiles with the same number of pixels to compute (which depends on the density
+// of spots) rendered in parallel. each pixel belongs to a single tile where the spots are added in the same
+// order as in a serial computation, so the result does not depend on the number of threads.
+static void render_model_image(specex::image_data& model_image, const specex::image_data& weight, const specex::PSF_p psf, const std::vector<specex::Spot_p>& spots, bool only_on_spots, bool only_psf_core, bool only_positive, int predefined_begin_j, int predefined_end_j, int x_margin, int y_margin, int only_this_bundle, int number_of_threads, double tail_min_value) {
   
-  Stamp global_stamp = compute_stamp(model_image,psf,spots,x_margin,y_margin,only_this_bundle);
+  specex::Stamp global_stamp = specex::compute_stamp(model_image,psf,spots,x_margin,y_margin,only_this_bundle);
   if(global_stamp.end_i==0) {
     SPECEX_WARNING("empty global stamp (can occur in parallel processing)");
     return;
   }
-  //SPECEX_INFO("specex::compute_model_image [" << global_stamp.begin_i << ":" << global_stamp.end_i << "," << predefined_begin_j << ":" << predefined_end_j << "]");
-  
-  
-  vector<specex::Stamp> spot_stamps;
-  image_data spot_stamp_footprint; // because can overlap
-  if(only_on_spots) {
-    spot_stamp_footprint = image_data(model_image.n_cols(),model_image.n_rows());
-  }
-
-  for(size_t s=0;s<spots.size();s++) {
-    
-    specex::Spot_p spot = spots[s];
-    
-    
-
-    Stamp stamp(model_image);
-    psf->StampLimits(spot->xc,spot->yc,stamp.begin_i,stamp.end_i,stamp.begin_j,stamp.end_j);
-    stamp.begin_i = max(0,stamp.begin_i);
-    stamp.end_i   = min(stamp.Parent_n_cols(),stamp.end_i);
-    stamp.begin_j = max(0,stamp.begin_j);
-    stamp.end_j   = min(stamp.Parent_n_rows(),stamp.end_j);
-    spot_stamps.push_back(stamp);
-
-    if(only_this_bundle>=0 && (spot->fiber_bundle != only_this_bundle)) continue;
-
-    if(only_on_spots) {
-      for(int j=stamp.begin_j;j<stamp.end_j;j++)
-	for(int i=stamp.begin_i;i<stamp.end_i;i++)
-	  spot_stamp_footprint(i,j)=1;
-    }
-  }
   
   int begin_j = global_stamp.begin_j;
   int end_j   = global_stamp.end_j;
-  
   if(predefined_begin_j>=0)
     begin_j = max(begin_j,predefined_begin_j);
   if(predefined_end_j>=0)
     end_j = min(end_j,predefined_end_j);
-  			     
+  if(end_j<=begin_j) return;
   
+  int margin = min(MAX_X_MARGIN,psf->hSizeX); // 7 is half distance between center of ext. fibers of adjacent bundles
+  if(x_margin>0) margin=x_margin;
   
 #ifdef EXTERNAL_TAIL  
-  int psf_tail_index = psf->ParamIndex("TAILAMP");
+  int psf_tail_index = psf->ParamLayout().tail_amplitude;
+  double tail_half_size_x = 0;
+  double tail_half_size_y = 0;
+  psf->TailSupportHalfSize(tail_half_size_x,tail_half_size_y);
 #endif
   double eps=1.e-20;
-
-  // process per bundle
-  int count=0;
-  for(std::map<int,PSF_Params>::iterator bundle_it = psf->ParamsOfBundles.begin(); bundle_it != psf->ParamsOfBundles.end(); bundle_it++ , count++) {
+  
+  // bundles and their spots, in the order they are computed
+  vector<const specex::PSF_Params*> bundles;
+  vector<vector<int> > spots_of_bundle;
+  vector<int> bundle_of_spot(spots.size(),-1);
+  for(std::map<int,specex::PSF_Params>::const_iterator bundle_it = psf->ParamsOfBundles.begin(); bundle_it != psf->ParamsOfBundles.end(); bundle_it++) {
+    if(only_this_bundle>=0 && (bundle_it->second.bundle_id != only_this_bundle)) continue;
+    bundles.push_back(&(bundle_it->second));
+    spots_of_bundle.push_back(vector<int>());
+    for(size_t s=0;s<spots.size();s++)
+      if(spots[s]->fiber_bundle == bundle_it->first) {
+	spots_of_bundle.back().push_back(int(s));
+	bundle_of_spot[s] = int(bundles.size())-1;
+      }
+  }
+  
+#ifdef CONTINUUM
+  vector<vector<const specex::Trace*> > continuum_traces_of_bundle(bundles.size()); // 0 if off
+  for(size_t b=0;b<bundles.size();b++)
+    for(int fiber=bundles[b]->fiber_min; fiber<=bundles[b]->fiber_max; fiber++) {
+      const specex::Trace& trace = psf->GetTrace(fiber);
+      continuum_traces_of_bundle[b].push_back(trace.Off() ? 0 : &trace);
+    }
+#endif
+  
+  // prepare spots
+  vector<RenderedSpot> rendered(spots.size());
+#pragma omp parallel for schedule(dynamic) num_threads(max(1,number_of_threads))
+  for(int s=0;s<int(spots.size());s++) {
     
-    const PSF_Params& params_of_bundle = bundle_it->second;
-    if(only_this_bundle>=0 && (params_of_bundle.bundle_id != only_this_bundle)) continue;
+    RenderedSpot& r = rendered[s];
+    r.spot = spots[s];
     
-    int margin = min(MAX_X_MARGIN,psf->hSizeX); // 7 is half distance between center of ext. fibers of adjacent bundles
-    if(x_margin>0) margin=x_margin;
+    r.stamp = specex::Stamp(model_image);
+    psf->StampLimits(r.spot->xc,r.spot->yc,r.stamp.begin_i,r.stamp.end_i,r.stamp.begin_j,r.stamp.end_j);
+    r.stamp.begin_i = max(model_image.begin_i(),r.stamp.begin_i);
+    r.stamp.end_i   = min(model_image.end_i(),r.stamp.end_i);
+    r.stamp.begin_j = max(model_image.begin_j(),r.stamp.begin_j);
+    r.stamp.end_j   = min(model_image.end_j(),r.stamp.end_j);
+    r.support_begin_i = r.support_end_i = r.support_begin_j = r.support_end_j = 0;
     
-    for (int j=begin_j; j <end_j; ++j) { 
-      
-      int begin_i = max(global_stamp.begin_i, int(floor(psf->GetTrace(params_of_bundle.fiber_min).X_vs_Y.Value(double(j))+0.5))-margin);
-      int end_i   = min(global_stamp.end_i  , int(floor(psf->GetTrace(params_of_bundle.fiber_max).X_vs_Y.Value(double(j))+0.5))+margin+1);
+    if(bundle_of_spot[s]<0) continue; // not computed
+    
+    psf->AllLocalParamsXW(r.spot->xc,r.spot->wavelength,r.spot->fiber_bundle,r.params);
+    r.has_tail = false;
+#ifdef EXTERNAL_TAIL
+    r.has_tail = r.params[psf_tail_index]!=0;
+#endif
+    r.only_core = ( only_psf_core || (!r.has_tail) );
+    
+    r.support_begin_i = max(global_stamp.begin_i,r.stamp.begin_i);
+    r.support_end_i   = min(global_stamp.end_i,r.stamp.end_i);
+    r.support_begin_j = max(begin_j,r.stamp.begin_j);
+    r.support_end_j   = min(end_j,r.stamp.end_j);
+#ifdef EXTERNAL_TAIL
+    if(!r.only_core) { // the tail profile is zero beyond its support, and neglected below tail_min_value
+      double half_size_x = tail_half_size_x;
+      double half_size_y = tail_half_size_y;
+      if(tail_min_value>0) psf->TailSupportHalfSize(half_size_x,half_size_y,r.spot->flux*r.params[psf_tail_index],tail_min_value);
+      r.support_begin_i = max(global_stamp.begin_i,min(r.stamp.begin_i,int(floor(r.spot->xc-half_size_x))));
+      r.support_end_i   = min(global_stamp.end_i,max(r.stamp.end_i,int(floor(r.spot->xc+half_size_x))+1));
+      r.support_begin_j = max(begin_j,min(r.stamp.begin_j,int(floor(r.spot->yc-half_size_y))));
+      r.support_end_j   = min(end_j,max(r.stamp.end_j,int(floor(r.spot->yc+half_size_y))+1));
+    }
+#endif
+    
+    psf->PrepareStampCache(r.spot->xc,r.spot->yc,r.stamp.begin_i,r.stamp.end_i,max(begin_j,r.stamp.begin_j),min(end_j,r.stamp.end_j),r.params,false,r.stamp_cache);
+  }
+  
+  // tiles of rows with about the same number of pixels to compute
+  int nrows = end_j-begin_j;
+  vector<double> cost_of_row(nrows,double(global_stamp.end_i-global_stamp.begin_i)*bundles.size()); // zero and continuum
+  for(size_t s=0;s<spots.size();s++) {
+    const RenderedSpot& r = rendered[s];
+    for(int j=max(begin_j,r.support_begin_j);j<min(end_j,r.support_end_j);j++)
+      cost_of_row[j-begin_j] += max(0,r.support_end_i-r.support_begin_i);
+  }
+  int number_of_tiles = max(1,min(number_of_threads,nrows));
+  vector<int> tile_begin_j(number_of_tiles+1,end_j);
+  {
+    double total_cost = 0;
+    for(int r=0;r<nrows;r++) total_cost += cost_of_row[r];
+    tile_begin_j[0] = begin_j;
+    double cost = 0;
+    int t = 1;
+    for(int r=0;r<nrows && t<number_of_tiles;r++) {
+      cost += cost_of_row[r];
+      if(cost >= t*total_cost/number_of_tiles) tile_begin_j[t++] = begin_j+r+1;
+    }
+  }
+  
+#pragma omp parallel for schedule(dynamic) num_threads(number_of_tiles)
+  for(int t=0;t<number_of_tiles;t++) {
+    
+    int tile_begin = tile_begin_j[t];
+    int tile_end   = tile_begin_j[t+1];
+    if(tile_end<=tile_begin) continue;
 
-      // zero the frame
-      for (int i=begin_i ; i <end_i; ++i) {
-	model_image(i,j) = 0;
+    // stamps of spots, on this tile
+    specex::image_data spot_stamp_footprint; // because can overlap
+    if(only_on_spots) {
+      spot_stamp_footprint.resize_window(global_stamp.begin_i,global_stamp.end_i,tile_begin,tile_end);
+      for(size_t s=0;s<spots.size();s++) {
+	if(only_this_bundle>=0 && (spots[s]->fiber_bundle != only_this_bundle)) continue;
+	const specex::Stamp& stamp = rendered[s].stamp;
+	for(int j=max(tile_begin,stamp.begin_j);j<min(tile_end,stamp.end_j);j++)
+	  for(int i=max(global_stamp.begin_i,stamp.begin_i);i<min(global_stamp.end_i,stamp.end_i);i++)
+	    spot_stamp_footprint(i,j)=1;
       }
-      
-      
+    }
+    
 #ifdef CONTINUUM
-      
-      if(params_of_bundle.ContinuumPol.coeff[0]!=0) {
-	for(int fiber=params_of_bundle.fiber_min; fiber<=params_of_bundle.fiber_max; fiber++) {
-	  
-	  if(psf->GetTrace(fiber).Off()) continue;
-	  
-	  double x = psf->GetTrace(fiber).X_vs_Y.Value(double(j));
-	  double w = psf->GetTrace(fiber).W_vs_Y.Value(double(j));
-	  double continuum_flux = params_of_bundle.ContinuumPol.Value(w);
-	  double expfact_for_continuum=continuum_flux/(sqrt(2*M_PI)*params_of_bundle.continuum_sigma_x);
-	  if(expfact_for_continuum!=0) {
-	    for (int i=begin_i ; i <end_i; ++i) {    
-	      if(weight(i,j)<=0) continue;
-	      if(only_on_spots && spot_stamp_footprint(i,j)==0) continue;
-	      
-	      double val = expfact_for_continuum*exp(-0.5*square((i-x)/params_of_bundle.continuum_sigma_x));
-	      if(val>0 || (!only_positive))
-		model_image(i,j) += val;
-	      else if(model_image(i,j)==0) 
-		model_image(i,j) = eps;
-	      
-	    } // end of loop on i
-	  } // expfact
-	} // end of loop on fiber
-      } // end of test on continuum
-#endif  
+    specex::ContinuumRow continuum_row;
+#endif
+    vector<int> begin_i_of_row(tile_end-tile_begin);
+    vector<int> end_i_of_row(tile_end-tile_begin);
+    vector<double> row_core_values;
     
-    } // end of loop on j
+    for(size_t b=0;b<bundles.size();b++) {
       
-    int nspots_in_stamp = 0;
-    for(size_t s=0;s<spots.size();s++) {
-      if(spots[s]->fiber_bundle == bundle_it->first) nspots_in_stamp ++;
-    }
-
-    // loop on spots
-    int sok=0;
-    for(size_t s=0;s<spots.size();s++) {
-
+      const specex::PSF_Params& params_of_bundle = *(bundles[b]);
       
-
-      specex::Spot_p spot = spots[s];
-      if(spot->fiber_bundle != bundle_it->first) continue; // keep only spots of this bundle
-      
-      //if(sok%100==0) SPECEX_INFO("spot " << sok << "/" << nspots_in_stamp);
-      sok++;
+      for (int j=tile_begin; j <tile_end; ++j) { 
+	
+	int begin_i = max(global_stamp.begin_i, int(floor(psf->GetTrace(params_of_bundle.fiber_min).XofRow(j)+0.5))-margin);
+	int end_i   = min(global_stamp.end_i  , int(floor(psf->GetTrace(params_of_bundle.fiber_max).XofRow(j)+0.5))+margin+1);
+	begin_i_of_row[j-tile_begin] = begin_i;
+	end_i_of_row[j-tile_begin]   = end_i;
+	
+	// zero the frame
+	for (int i=begin_i ; i <end_i; ++i) {
+	  model_image(i,j) = 0;
+	}
+	
+#ifdef CONTINUUM
+	if(params_of_bundle.ContinuumPol.coeff[0]!=0) {
+	  continuum_row.Fill(params_of_bundle,continuum_traces_of_bundle[b],params_of_bundle.ContinuumPol.coeff,j,begin_i,end_i);
+	  for(int f=0; f<continuum_row.NFibers(); f++) {
+	    
+	    double continuum_flux = continuum_row.flux[f];
+	    if(continuum_flux!=0) {
+	      for (int i=begin_i ; i <end_i; ++i) {    
+		if(weight(i,j)<=0) continue;
+		if(only_on_spots && spot_stamp_footprint(i,j)==0) continue;
+		
+		// beyond the tabulated cross-profile the continuum is negligible but not null
+		double val = 0;
+		if(i>=continuum_row.begin_i[f] && i<continuum_row.end_i[f])
+		  val = continuum_flux*continuum_row.Profile(f,i);
+		if(val>0 || (!only_positive && val!=0))
+		  model_image(i,j) += val;
+		else if(model_image(i,j)==0) 
+		  model_image(i,j) = eps;
+		
+	      } // end of loop on i
+	    } // continuum_flux
+	  } // end of loop on fiber
+	} // end of test on continuum
+#endif  
+      } // end of loop on j
       
-      const Stamp& spot_stamp=spot_stamps[s];
-
-      unbls::vector_double spot_params = psf->AllLocalParamsXW(spot->xc,spot->wavelength,spot->fiber_bundle);
-      bool has_tail  = spot_params[psf_tail_index]!=0;
-      bool only_core = ( only_psf_core || (!has_tail) );
+      bool first_spot_with_tail = true;
       
-      for (int j=begin_j; j <end_j; ++j) { 
-	
-	int margin = min(MAX_X_MARGIN,psf->hSizeX); 
- 	if(x_margin>0) margin=x_margin;
+      for(size_t k=0;k<spots_of_bundle[b].size();k++) {
 	
-	int begin_i = max(global_stamp.begin_i, int(floor(psf->GetTrace(params_of_bundle.fiber_min).X_vs_Y.Value(double(j))+0.5))-margin);
-	int end_i   = min(global_stamp.end_i  , int(floor(psf->GetTrace(params_of_bundle.fiber_max).X_vs_Y.Value(double(j))+0.5))+margin+1);
+	const RenderedSpot& r = rendered[spots_of_bundle[b][k]];
+	const specex::Spot_p& spot = r.spot;
+	const specex::PSFStampCache& stamp_cache = r.stamp_cache;
+	row_core_values.resize(max(1,stamp_cache.end_i-stamp_cache.begin_i));
 	
-	if(only_core) {
-	  if(j<spot_stamp.begin_j || j>=spot_stamp.end_j ) continue;
-	  begin_i = max(begin_i,spot_stamp.begin_i);
-	  end_i   = min(end_i,spot_stamp.end_i);	  
+	// the tail of a spot is zero beyond its support, where, as a null value, it only sets to eps
+	// the pixels at zero. this matters only for the first spot with a tail, after which no pixel is at zero.
+	if(!r.only_core && first_spot_with_tail) {
+	  first_spot_with_tail = false;
+	  if(only_positive) {
+	    for (int j=tile_begin; j <tile_end; ++j) {
+	      bool in_support_rows = (j>=r.support_begin_j && j<r.support_end_j);
+	      for(int i=begin_i_of_row[j-tile_begin]; i<end_i_of_row[j-tile_begin];i++) {
+		if(in_support_rows && i>=r.support_begin_i && i<r.support_end_i) continue;
+		if(weight(i,j)<=0) continue;
+		if(only_on_spots && spot_stamp_footprint(i,j)==0) continue;
+		if(model_image(i,j)==0) model_image(i,j) = eps;
+	      }
+	    }
+	  }
 	}
-
-	for(int i=begin_i; i<end_i;i++) {
-	  
-	  if(weight(i,j)<=0) continue;
-	  
-	  bool in_core =  spot_stamp.Contains(i,j);
-	  if(!in_core && only_psf_core) continue;
-	  
-	  if(only_on_spots && spot_stamp_footprint(i,j)==0) continue;
+	
+	for (int j=max(tile_begin,r.support_begin_j); j <min(tile_end,r.support_end_j); ++j) { 
 	  
-	  double val = spot->flux*psf->PSFValueWithParamsXY(spot->xc,spot->yc, i, j, spot_params, 0, 0, in_core, has_tail); // compute CPU expensive PSF core only if needed
+	  int begin_i = max(begin_i_of_row[j-tile_begin],r.support_begin_i);
+	  int end_i   = min(end_i_of_row[j-tile_begin],r.support_end_i);
 	  
-	  if(val>0 || (!only_positive))
-	    model_image(i,j) += val; // this now includes core and tails
-	  else if(model_image(i,j)==0) 
-	    model_image(i,j) = eps;
+	  // psf core values of the whole row of the stamp at once
+	  bool row_in_cache = stamp_cache.Contains(stamp_cache.begin_i,j);
+	  if(row_in_cache) psf->RowValuesFromStampCache(stamp_cache,j,r.params,&row_core_values[0]);
 	  
-	} // end of loop on i  
-      } // end of loop on j
-    } // end of loop on spots
-  } // end of loop on bundles
-} // end of func
+	  for(int i=begin_i; i<end_i;i++) {
+	    
+	    if(weight(i,j)<=0) continue;
+	    
+	    bool in_core =  r.stamp.Contains(i,j);
+	    if(!in_core && only_psf_core) continue;
+	    
+	    if(only_on_spots && spot_stamp_footprint(i,j)==0) continue;
+	    
+	    double val = 0;
+	    if(in_core && row_in_cache && stamp_cache.Contains(i,j)) {
+	      val = row_core_values[i-stamp_cache.begin_i];
+#ifdef EXTERNAL_TAIL
+	      if(r.has_tail) val += psf->TailValueWithParamsXY(spot->xc,spot->yc, i, j, r.params, in_core);
+#endif
+	      val *= spot->flux;
+	    }else{
+	      val = spot->flux*psf->PSFValueWithParamsXY(spot->xc,spot->yc, i, j, r.params, 0, 0, in_core, r.has_tail, &stamp_cache); // compute CPU expensive PSF core only if needed
+	    }
+	    
+	    if(val>0 || (!only_positive))
+	      model_image(i,j) += val; // this now includes core and tails
+	    else if(model_image(i,j)==0) 
+	      model_image(i,j) = eps;
+	    
+	  } // end of loop on i  
+	} // end of loop on j
+      } // end of loop on spots
+    } // end of loop on bundles
+  } // end of loop on tiles
+}
+
+void specex::parallelized_compute_model_image(specex::image_data& model_image, const specex::image_data& weight, const specex::PSF_p psf, const std::vector<specex::Spot_p>& spots, bool only_on_spots, bool only_psf_core, bool only_positive, int x_margin, int y_margin, int only_this_bundle, int number_of_threads, double tail_min_value) {
+
+  SPECEX_DEBUG("parallelized_compute_model_image");
+  
+#ifdef EXTERNAL_TAIL  
+  // precompute tail profile
+  psf->TailProfile(0,0,psf->AllLocalParamsFW(spots[0]->fiber,spots[0]->wavelength,spots[0]->fiber_bundle));
+#endif
+
+  unbls::zero(model_image.data);
+  
+  render_model_image(model_image,weight,psf,spots,only_on_spots,only_psf_core,only_positive,-1,-1,x_margin,y_margin,only_this_bundle,max(1,number_of_threads),tail_min_value);
+}
+
+void specex::compute_model_image(specex::image_data& model_image, const specex::image_data& weight, const specex::PSF_p psf, const std::vector<specex::Spot_p>& spots, bool only_on_spots, bool only_psf_core, bool only_positive, int predefined_begin_j, int predefined_end_j, int x_margin, int y_margin, int only_this_bundle, double tail_min_value) {
+  
+  render_model_image(model_image,weight,psf,spots,only_on_spots,only_psf_core,only_positive,predefined_begin_j,predefined_end_j,x_margin,y_margin,only_this_bundle,1,tail_min_value);
+}
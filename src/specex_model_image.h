@@ -14,11 +14,15 @@
 
 namespace specex {
   
+  // rectangle containing the stamps of the spots, within the pixels of model_image (which can be a window of the ccd)
   Stamp compute_stamp(const image_data& model_image, const PSF_p psf, const std::vector<specex::Spot_p>& spots, int x_margin, int y_margin, int only_this_bundle=-1);
 			   
-  void compute_model_image(image_data& model_image, const specex::image_data& weight, const PSF_p psf, const std::vector<specex::Spot_p>& spots, bool only_on_spots, bool only_psf_core, bool only_positive, int begin_j, int end_j, int x_margin, int y_margin, int only_this_bundle=-1);
+  // the tail of a spot is not computed where flux x tail is below tail_min_value (if >0), see PSF::TailSupportHalfSize
+  void compute_model_image(image_data& model_image, const specex::image_data& weight, const PSF_p psf, const std::vector<specex::Spot_p>& spots, bool only_on_spots, bool only_psf_core, bool only_positive, int begin_j, int end_j, int x_margin, int y_margin, int only_this_bundle=-1, double tail_min_value=0);
   
-  void parallelized_compute_model_image(image_data& model_image, const specex::image_data& weight, const PSF_p psf, const std::vector<specex::Spot_p>& spots, bool only_on_spots, bool only_psf_core, bool only_positive, int x_margin, int y_margin, int only_this_bundle=-1);
+  // same as compute_model_image, the model of each spot being computed once and added to number_of_threads bands
+  // of rows with about the same number of pixels to compute, filled in parallel (result independent of the number of threads)
+  void parallelized_compute_model_image(image_data& model_image, const specex::image_data& weight, const PSF_p psf, const std::vector<specex::Spot_p>& spots, bool only_on_spots, bool only_psf_core, bool only_positive, int x_margin, int y_margin, int only_this_bundle=-1, int number_of_threads=1, double tail_min_value=0);
   
   
 };
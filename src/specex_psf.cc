@@ -1,6 +1,7 @@
 #include <iomanip>
 #include <cmath>
 #include <string>
+#include <algorithm>
 
 #include "specex_psf.h"
 //#include "specex_base_analytic_psf.h"
@@ -36,12 +37,12 @@ double specex::PSF::PixValue(const double &Xc, const double &Yc,
   double xPixCenter = floor(XPix+0.5);
   double yPixCenter = floor(YPix+0.5);
   
-  unbls::vector_double tmpPosDer;
+  thread_local unbls::vector_double tmpPosDer; // per-thread scratch
+  thread_local unbls::vector_double tmpParamDer;
   if(PosDer) {
     tmpPosDer.resize(2);
     unbls::zero(tmpPosDer);
   }
-  unbls::vector_double tmpParamDer;
   int npar=0;
   if(ParamDer) {
     npar = ParamDer->size();
@@ -97,6 +98,8 @@ double specex::PSF::PixValue(const double &Xc, const double &Yc,
 specex::PSF::PSF() {
   name = "unknown";
   hSizeX = hSizeY = 12;
+  CompileParamLayout(); // no parameter yet
+  frozen = false;
 
 #ifdef EXTERNAL_TAIL
   r_tail_profile_must_be_computed = true;
@@ -114,10 +117,77 @@ specex::PSF::PSF() {
   camera_id="unknown";
 }
 
+#ifdef CONTINUUM
+#define CONTINUUM_NSIGMA 10
+
+void specex::ContinuumRow::Fill(const PSF_Params& params, const std::vector<const Trace*>& traces, const unbls::vector_double& continuum_params,
+				int j, int row_begin_i, int row_end_i) {
+  size_t nfibers = traces.size();
+  begin_i.resize(nfibers);
+  end_i.resize(nfibers);
+  offset.resize(nfibers);
+  flux.resize(nfibers);
+  monomials.resize(nfibers);
+  profile.clear(); // keeps its capacity from row to row
+  
+  double sigma = params.continuum_sigma_x;
+  double expfact = 1./(sqrt(2*M_PI)*sigma);
+  int half_width = int(ceil(CONTINUUM_NSIGMA*sigma));
+  
+  for(size_t f=0; f<nfibers; f++) {
+    offset[f] = profile.size();
+    begin_i[f] = end_i[f] = row_begin_i;
+    flux[f] = 0;
+    const Trace* trace = traces[f];
+    if(!trace) continue;
+    double x = trace->XofRow(j);
+    params.ContinuumPol.Monomials(trace->WofRow(j),monomials[f]);
+    flux[f] = specex::dot(continuum_params,monomials[f]);
+    int i_center = int(floor(x));
+    begin_i[f] = max(row_begin_i,i_center-half_width);
+    end_i[f]   = max(begin_i[f],min(row_end_i,i_center+half_width+2));
+    for(int i=begin_i[f]; i<end_i[f]; i++)
+      profile.push_back(expfact * exp(-0.5*square((i-x)/sigma)));
+  }
+}
+#endif
+
 #ifdef EXTERNAL_TAIL
-#define NX_TAIL_PROFILE 1000
-#define NY_TAIL_PROFILE 8000
-#define TAIL_OVERSAMPLING 2.
+#define TAIL_HALF_SIZE_X 499.5
+#define TAIL_HALF_SIZE_Y 3999.5
+#define N_TAIL_PROFILE 4096
+
+specex::TailProfileTable::TailProfileTable(const double& r2_core_size, const double& i_x_scale, const double& i_y_scale, const double& power_law_index,
+					     const double& i_half_size_x, const double& i_half_size_y, int n_nodes) :
+  half_size_x(i_half_size_x),
+  half_size_y(i_half_size_y),
+  x_scale(i_x_scale),
+  y_scale(i_y_scale)
+{
+  // log spacing beyond the core : the relative accuracy of the power law is uniform up to the edges
+  r_scale = (r2_core_size>0) ? sqrt(r2_core_size) : 1.;
+  inv_r_scale = 1./r_scale;
+  double r_max = sqrt(square(half_size_x*x_scale)+square(half_size_y*y_scale));
+  double du = log(1.+r_max*inv_r_scale)/(n_nodes-1);
+  inv_du = 1./du;
+  values.resize(n_nodes);
+  for(int k=0;k<n_nodes;k++) {
+    double r2 = square(NodeRadius(k));
+    values[k] = float(r2/(r2_core_size+r2)*pow(r2_core_size+r2,-power_law_index/2.));
+  }
+  peak = int(max_element(values.begin(),values.end())-values.begin());
+}
+
+int specex::TailProfileTable::FirstNodeBelow(const double& min_value) const {
+  // binary search on the decreasing part of the profile
+  int k1 = peak;
+  int k2 = int(values.size());
+  while(k1<k2) {
+    int k = (k1+k2)/2;
+    if(values[k]<min_value) k2=k; else k1=k+1;
+  }
+  return k1;
+}
 
 double specex::PSF::TailProfileValue(const double& dx, const double &dy) const {
   double r2 = square(dx*r_tail_x_scale)+square(dy*r_tail_y_scale);
@@ -129,29 +199,49 @@ void specex::PSF::ComputeTailProfile(const unbls::vector_double &Params) {
     SPECEX_WARNING("calling specex::PSF::ComputeTailProfile when r_tail_profile_must_be_computed =false");
     return;
   }
-
-  SPECEX_INFO("specex::PSF::ComputeTailProfile ...");
-  
-  r_tail_profile.resize(NX_TAIL_PROFILE,NY_TAIL_PROFILE); // hardcoded
   
   if(! HasParam("TAILCORE"))
     SPECEX_ERROR("in PSF::ComputeTailProfile, missing param TAILCORE, need to allocate them, for instance with PSF::AllocateDefaultParams()");
   
+  std::vector<std::string> ParamNames;
+  for(size_t p=0;p<ParamsOfBundles.begin()->second.AllParPolXW.size();p++)
+    ParamNames.push_back(ParamName(p));
+  ComputeTailProfile(Params,ParamNames);
+}
 
-  r2_tail_core_size = square(Params[ParamIndex("TAILCORE")]);
-  r_tail_x_scale   = Params[ParamIndex("TAILXSCA")];
-  r_tail_y_scale   = Params[ParamIndex("TAILYSCA")];
-  r_tail_power_law_index = Params[ParamIndex("TAILINDE")];
-  
+void specex::PSF::PrepareTailProfile(bool with_default_params) {
+  if(r_tail_profile_must_be_computed == false) return;
   
-  for(int j=0;j<NY_TAIL_PROFILE;j++) {
-    for(int i=0;i<NX_TAIL_PROFILE;i++) {
-      r_tail_profile(i,j) = TailProfileValue(i/TAIL_OVERSAMPLING,j/TAIL_OVERSAMPLING);
-    }
+  if(with_default_params) {
+    ComputeTailProfile(DefaultParams(),DefaultParamNames());
+    return;
   }
+  if(! HasParam("TAILCORE")) return; // will be computed at the first call of TailProfile
+  
+  // the tail shape parameters are not fit and do not vary, take their value at the center of the first bundle
+  const std::vector<Pol_p>& AP = ParamsOfBundles.begin()->second.AllParPolXW;
+  unbls::vector_double Params(AP.size());
+  for(size_t p=0;p<AP.size();p++)
+    Params[p] = AP[p]->Value(0.5*(AP[p]->xmin+AP[p]->xmax),0.5*(AP[p]->ymin+AP[p]->ymax));
+  ComputeTailProfile(Params);
+}
+
+void specex::PSF::ComputeTailProfile(const unbls::vector_double &Params, const std::vector<std::string>& ParamNames) {
+  
+  SPECEX_INFO("specex::PSF::ComputeTailProfile ...");
+  
+  int index_of_tail_amplitude = find(ParamNames.begin(),ParamNames.end(),"TAILAMP")-ParamNames.begin();
+  r2_tail_core_size = square(Params[find(ParamNames.begin(),ParamNames.end(),"TAILCORE")-ParamNames.begin()]);
+  r_tail_x_scale   = Params[find(ParamNames.begin(),ParamNames.end(),"TAILXSCA")-ParamNames.begin()];
+  r_tail_y_scale   = Params[find(ParamNames.begin(),ParamNames.end(),"TAILYSCA")-ParamNames.begin()];
+  r_tail_power_law_index = Params[find(ParamNames.begin(),ParamNames.end(),"TAILINDE")-ParamNames.begin()];
+  
+  
+  r_tail_profile.reset(new specex::TailProfileTable(r2_tail_core_size,r_tail_x_scale,r_tail_y_scale,r_tail_power_law_index,
+						    TAIL_HALF_SIZE_X,TAIL_HALF_SIZE_Y,N_TAIL_PROFILE));
 
   // store index of PSF tail amplitude
-  psf_tail_amplitude_index = ParamIndex("TAILAMP");
+  psf_tail_amplitude_index = index_of_tail_amplitude;
 
   r_tail_profile_must_be_computed = false;
   SPECEX_INFO("specex::PSF::ComputeTailProfile done");
@@ -164,31 +254,39 @@ double specex::PSF::TailProfile(const double& dx, const double &dy, const unbls:
   if(r_tail_profile_must_be_computed) {
 #pragma omp critical
     {
-      const_cast<specex::PSF*>(this)->ComputeTailProfile(Params);
+      if(r_tail_profile_must_be_computed) // another thread may have done it
+	const_cast<specex::PSF*>(this)->ComputeTailProfile(Params);
     }
   }
   if(full_calculation) return TailProfileValue(dx,dy);
+  return r_tail_profile->Value(dx,dy);
+}
+
+void specex::PSF::TailSupportHalfSize(double& half_size_x, double& half_size_y) const {
+  half_size_x = TAIL_HALF_SIZE_X;
+  half_size_y = TAIL_HALF_SIZE_Y;
+}
+
+void specex::PSF::TailSupportHalfSize(double& half_size_x, double& half_size_y, const double& amplitude, const double& min_value) const {
+  TailSupportHalfSize(half_size_x,half_size_y);
+  if(min_value<=0 || !r_tail_profile) return;
+  
+  const specex::TailProfileTable& table = *r_tail_profile;
+  if(table.x_scale<=0 || table.y_scale<=0) return;
+  
+  int k = (amplitude!=0) ? table.FirstNodeBelow(min_value/fabs(amplitude)) : table.peak;
+  if(k>=int(table.values.size())) return; // above min_value everywhere
+  if(k==table.peak) k=0; // below min_value everywhere
   
-  double dxo = fabs(dx*TAIL_OVERSAMPLING);
-  double dyo = fabs(dy*TAIL_OVERSAMPLING);
-  int di = int(dxo);
-  int dj = int(dyo);
-  if(di>=NX_TAIL_PROFILE-1 || dj>=NY_TAIL_PROFILE-1) return 0.;
-  return r_tail_profile(di,dj); // faster
-  return (
-	  (di+1-dxo)*(dj+1-dyo)*r_tail_profile(di,dj)
-	  +(dxo-di)*(dj+1-dyo)*r_tail_profile(di+1,dj)
-	  +(di+1-dxo)*(dyo-dj)*r_tail_profile(di,dj+1)
-	  +(dxo-di)*(dyo-dj)*r_tail_profile(di+1,dj+1)
-	  );
+  double radius = table.NodeRadius(k);
+  half_size_x = min(half_size_x,radius/table.x_scale);
+  half_size_y = min(half_size_y,radius/table.y_scale);
 }
 
 #endif
 
 int specex::PSF::BundleNFitPar(int bundle_id) const {
-  std::map<int,PSF_Params>::const_iterator it = ParamsOfBundles.find(bundle_id);
-  if(it==ParamsOfBundles.end()) SPECEX_ERROR("no such bundle #" << bundle_id);
-  const std::vector<Pol_p>& P=it->second.FitParPolXW;
+  const std::vector<Pol_p>& P=ParamsOfBundle(bundle_id).FitParPolXW;
   int n=0;
   for(size_t p=0;p<P.size();p++)
     n += P[p]->coeff.size();
@@ -213,6 +311,44 @@ int specex::PSF::ParamIndex(const std::string& name) const {
 bool specex::PSF::HasParam(const std::string& name) const { 
   return (ParamIndex(name)>=0);
 }
+
+void specex::PSF::CompileParamLayout() {
+  
+  param_layout = specex::PSFParamLayout();
+  param_layout.nparams = 0;
+  if(!ParamsOfBundles.size()) return;
+  
+  const std::vector<Pol_p>& P = ParamsOfBundles.begin()->second.AllParPolXW;
+  int nparams = P.size();
+  param_layout.nparams = nparams;
+  param_layout.gh_i.assign(nparams,-1);
+  param_layout.gh_j.assign(nparams,-1);
+  param_layout.linear.assign(nparams,false);
+  
+  for(int p=0;p<nparams;p++) {
+    const std::string& pname = P[p]->name;
+    int i,j;
+    if(pname=="GHSIGX") param_layout.ghsigx = p;
+    else if(pname=="GHSIGY") param_layout.ghsigy = p;
+    else if(pname=="TAILAMP") {param_layout.tail_amplitude = p; param_layout.linear[p] = true;}
+    else if(pname=="TAILCORE") param_layout.tail_core = p;
+    else if(pname=="TAILXSCA") param_layout.tail_x_scale = p;
+    else if(pname=="TAILYSCA") param_layout.tail_y_scale = p;
+    else if(pname=="TAILINDE") param_layout.tail_index = p;
+    else if(sscanf(pname.c_str(),"GH-%d-%d",&i,&j)==2) {
+      param_layout.gh_i[p] = i;
+      param_layout.gh_j[p] = j;
+      param_layout.linear[p] = true; // the gaussian is multiplied by a linear combination of hermite pols
+    }
+  }
+}
+
+const specex::PSFParamLayout& specex::PSF::ParamLayout() const {
+  int nparams = (ParamsOfBundles.size() ? int(ParamsOfBundles.begin()->second.AllParPolXW.size()) : 0);
+  if(param_layout.nparams != nparams)
+    SPECEX_ERROR("PSF parameter layout compiled for " << param_layout.nparams << " parameters instead of " << nparams << ", call CompileParamLayout after changing the parameters");
+  return param_layout;
+}
 /*
 void specex::PSF::AllocateDefaultParams() {
   unbls::vector_double params = DefaultParams();
@@ -242,17 +378,54 @@ void specex::PSF::StampLimits(const double &X, const double &Y,
 }
 
 const specex::Trace& specex::PSF::GetTrace(int fiber) const {
+  if(frozen) {
+    const specex::Trace* trace = snapshot.TraceOfFiber(fiber);
+    if(!trace) SPECEX_ERROR("No trace for fiber " << fiber);
+    return *trace;
+  }
   std::map<int,specex::Trace>::const_iterator it = FiberTraces.find(fiber);
   if(it == FiberTraces.end()) SPECEX_ERROR("No trace for fiber " << fiber);
   return it->second;
 }
 
 specex::Trace& specex::PSF::GetTrace(int fiber)  {
+  if(frozen) {
+    specex::Trace* trace = snapshot.TraceOfFiber(fiber);
+    if(!trace) SPECEX_ERROR("No trace for fiber " << fiber);
+    return *trace;
+  }
   std::map<int,specex::Trace>::iterator it = FiberTraces.find(fiber);
   if(it == FiberTraces.end()) SPECEX_ERROR("No trace for fiber " << fiber);
   return it->second;
 }
 
+void specex::PSF::Freeze() {
+  
+  snapshot = specex::PSFEvaluationSnapshot();
+  
+  if(FiberTraces.size()) {
+    snapshot.first_fiber = FiberTraces.begin()->first;
+    snapshot.traces.assign(FiberTraces.rbegin()->first-snapshot.first_fiber+1,0);
+    for(std::map<int,specex::Trace>::iterator it = FiberTraces.begin(); it != FiberTraces.end(); ++it)
+      snapshot.traces[it->first-snapshot.first_fiber] = &(it->second);
+  }
+  if(ParamsOfBundles.size()) {
+    snapshot.first_bundle = ParamsOfBundles.begin()->first;
+    snapshot.params_of_bundles.assign(ParamsOfBundles.rbegin()->first-snapshot.first_bundle+1,0);
+    for(std::map<int,specex::PSF_Params>::const_iterator it = ParamsOfBundles.begin(); it != ParamsOfBundles.end(); ++it)
+      snapshot.params_of_bundles[it->first-snapshot.first_bundle] = &(it->second);
+  }
+  
+  CompileParamLayout();
+  
+#ifdef EXTERNAL_TAIL
+  snapshot.tail_amplitude_index = param_layout.tail_amplitude;
+  PrepareTailProfile(false); // if the PSF has no parameter yet, it is computed at the first call of TailProfile
+#endif
+  
+  frozen = true;
+}
+
 void specex::PSF::LoadXYPol() {
 #pragma omp critical
   {
@@ -266,6 +439,7 @@ void specex::PSF::LoadXYPol() {
 }
 
 double specex::PSF::Xccd(int fiber, const double& wave) const {
+  if(frozen) return GetTrace(fiber).X_vs_W.Value(wave);
   std::map<int,specex::Legendre1DPol*>::const_iterator it = XPol.find(fiber);
   if(it==XPol.end()) {
     const_cast<specex::PSF*>(this)->LoadXYPol();
@@ -276,6 +450,7 @@ double specex::PSF::Xccd(int fiber, const double& wave) const {
 }
 
 double specex::PSF::Yccd(int fiber, const double& wave) const {
+  if(frozen) return GetTrace(fiber).Y_vs_W.Value(wave);
   std::map<int,specex::Legendre1DPol*>::const_iterator it = YPol.find(fiber);
   if(it==YPol.end()) {
     const_cast<specex::PSF*>(this)->LoadXYPol();
@@ -291,13 +466,18 @@ double specex::PSF::PSFValueWithParamsXY(const double &Xc, const double &Yc,
 					 const int IPix, const int JPix,
 					 const unbls::vector_double &Params,
 					 unbls::vector_double *PosDer, unbls::vector_double *ParamDer,
-					 bool with_core, bool with_tail) const {
+					 bool with_core, bool with_tail, const PSFStampCache* stamp_cache) const {
   
   if(PosDer) unbls::zero(*PosDer);
   if(ParamDer) unbls::zero(*ParamDer);
 
   double val = 0;
-  if(with_core) val += PixValue(Xc,Yc,IPix, JPix, Params, PosDer, ParamDer); 
+  if(with_core) {
+    if(stamp_cache && stamp_cache->Contains(IPix,JPix) && (stamp_cache->with_derivatives || (PosDer==0 && ParamDer==0)))
+      val += PixValueFromStampCache(*stamp_cache, IPix, JPix, Params, PosDer, ParamDer);
+    else
+      val += PixValue(Xc,Yc,IPix, JPix, Params, PosDer, ParamDer); 
+  }
 
 #ifdef EXTERNAL_TAIL
 #ifdef INTEGRATING_TAIL
@@ -349,16 +529,29 @@ int specex::PSF::GetBundleOfFiber(int fiber) const {
 }
 
 unbls::vector_double specex::PSF::AllLocalParamsXW(const double &X, const double &wave, int bundle_id) const {
-  
+  unbls::vector_double params;
+  AllLocalParamsXW(X,wave,bundle_id,params);
+  return params;
+}
+
+const specex::PSF_Params& specex::PSF::ParamsOfBundle(int bundle_id) const {
+  if(frozen) {
+    const specex::PSF_Params* params = snapshot.ParamsOfBundle(bundle_id);
+    if(!params) SPECEX_ERROR("no such bundle #" << bundle_id);
+    return *params;
+  }
   std::map<int,PSF_Params>::const_iterator it = ParamsOfBundles.find(bundle_id);
   if(it==ParamsOfBundles.end()) SPECEX_ERROR("no such bundle #" << bundle_id);
-  const std::vector<Pol_p>& P=it->second.AllParPolXW;
+  return it->second;
+}
+
+void specex::PSF::AllLocalParamsXW(const double &X, const double &wave, int bundle_id, unbls::vector_double& params) const {
+  
+  const std::vector<Pol_p>& P=ParamsOfBundle(bundle_id).AllParPolXW;
   
-  unbls::vector_double params(P.size());
+  params.resize(P.size());
   for (size_t k =0; k < P.size(); ++k)
     params[k] = P[k]->Value(X,wave);
-  
-  return params;
 }
 
 unbls::vector_double specex::PSF::AllLocalParamsFW(const int fiber, const double &wave, int bundle_id) const {
@@ -371,14 +564,19 @@ unbls::vector_double specex::PSF::AllLocalParamsFW(const int fiber, const double
 }
 
 unbls::vector_double specex::PSF::AllLocalParamsXW_with_FitBundleParams(const double &X, const double &wave, int bundle_id, const unbls::vector_double& ForThesePSFParams) const {
+  unbls::vector_double params;
+  AllLocalParamsXW_with_FitBundleParams(X,wave,bundle_id,ForThesePSFParams,params);
+  return params;
+}
+
+void specex::PSF::AllLocalParamsXW_with_FitBundleParams(const double &X, const double &wave, int bundle_id, const unbls::vector_double& ForThesePSFParams, unbls::vector_double& params) const {
   
+  thread_local unbls::vector_double monomials; // per-thread scratch
+  params.resize(LocalNAllPar());
   
-  unbls::vector_double params(LocalNAllPar());
-  
-  std::map<int,PSF_Params>::const_iterator it = ParamsOfBundles.find(bundle_id);
-  if(it==ParamsOfBundles.end()) SPECEX_ERROR("no such bundle #" << bundle_id);
-  const std::vector<Pol_p>& AP=it->second.AllParPolXW;
-  const std::vector<Pol_p>& FP=it->second.FitParPolXW;
+  const specex::PSF_Params& params_of_bundle = ParamsOfBundle(bundle_id);
+  const std::vector<Pol_p>& AP=params_of_bundle.AllParPolXW;
+  const std::vector<Pol_p>& FP=params_of_bundle.FitParPolXW;
   
   // whe need to find which param is fixed and which is not
   size_t fk=0;
@@ -390,7 +588,8 @@ unbls::vector_double specex::PSF::AllLocalParamsXW_with_FitBundleParams(const do
 
       size_t c_size = APk->coeff.size();
 
-      params[ak]=specex::dot(ForThesePSFParams,index,index+c_size,APk->Monomials(X,wave));
+      APk->Monomials(X,wave,monomials);
+      params[ak]=specex::dot(ForThesePSFParams,index,index+c_size,monomials);
       
       //SPECEX_INFO("DEBUG all param " << ak << " and fit = " << fk << " are the same, param val =  " << params(ak));
 
@@ -402,12 +601,20 @@ unbls::vector_double specex::PSF::AllLocalParamsXW_with_FitBundleParams(const do
       //SPECEX_INFO("DEBUG all param " << ak << " is not it fit, param val = " << params(ak));
     }
   }
-  return params;
 }
 
 bool specex::PSF::IsLinear() const {
-  if(Name() == "GAUSSHERMITE") return true;
-  return false;
+  const specex::PSFParamLayout& layout = ParamLayout();
+  for(int p=0;p<layout.nparams;p++)
+    if(!layout.linear[p]) return false;
+  return true;
+}
+
+bool specex::PSF::IsLinear(const std::vector<int>& params) const {
+  const specex::PSFParamLayout& layout = ParamLayout();
+  for(size_t k=0;k<params.size();k++)
+    if(!layout.linear[params[k]]) return false;
+  return true;
 }
 
 
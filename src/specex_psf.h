@@ -4,6 +4,8 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <memory>
+#include <cmath>
 
 #include "specex_legendre.h"
 #include "specex_trace.h"
@@ -80,7 +82,131 @@ namespace specex {
       {};
 
   };
+
+#ifdef CONTINUUM
+  //! continuum of the fibers of a bundle on one CCD row : for each fiber, the Legendre monomials
+  //! of the wavelength, the continuum flux and the gaussian cross-profile tabulated on the pixels
+  //! [begin_i,end_i[ within CONTINUUM_NSIGMA sigmas of the trace. Off fibers have an empty range.
+  class ContinuumRow {
+  public :
+    std::vector<int> begin_i;
+    std::vector<int> end_i;
+    std::vector<int> offset; // of the cross-profile of each fiber in profile
+    std::vector<double> profile;
+    std::vector<double> flux;
+    std::vector<unbls::vector_double> monomials;
+    
+    int NFibers() const { return int(flux.size());}
+    double Profile(int f, int i) const { return profile[offset[f]+i-begin_i[f]];}
+    
+    // traces are the ones of the fibers of the bundle (0 if off), the profiles are restricted to [row_begin_i,row_end_i[
+    void Fill(const PSF_Params& params, const std::vector<const Trace*>& traces, const unbls::vector_double& continuum_params,
+	      int j, int row_begin_i, int row_end_i);
+  };
+#endif
   
+  //! per-spot precomputation of the terms of a separable PSF core on a stamp :
+  //! terms along x are evaluated once per column and terms along y once per row,
+  //! their content is defined by the PSF implementation (see PSF::PrepareStampCache).
+  //! it is only valid for the position and parameters it was prepared with.
+  class PSFStampCache {
+  public :
+    int begin_i;
+    int end_i;
+    int begin_j;
+    int end_j;
+    bool with_derivatives;
+    int nx_terms; // number of terms per column
+    int ny_terms; // number of terms per row
+    unbls::vector_double x_terms;
+    unbls::vector_double y_terms;
+    
+  PSFStampCache() : begin_i(0), end_i(0), begin_j(0), end_j(0), with_derivatives(false), nx_terms(0), ny_terms(0) {};
+    
+    void clear() { begin_i=end_i=begin_j=end_j=0; }
+    bool Contains(const int i, const int j) const {
+      return (i>=begin_i && i<end_i && j>=begin_j && j<end_j);
+    }
+  };
+
+  //! read-only tables of a PSF filled by PSF::Freeze, so that it can be evaluated by several threads
+  //! without map lookups, locks nor lazy initialization.
+  //! they point to FiberTraces and ParamsOfBundles, so they follow the changes of the trace coefficients
+  //! and PSF parameters, but they must be filled again if traces or bundles are added or removed.
+  class PSFEvaluationSnapshot {
+  public :
+    int first_fiber;
+    std::vector<Trace*> traces; // trace of fiber first_fiber+k, 0 if none
+    int first_bundle;
+    std::vector<const PSF_Params*> params_of_bundles; // parameters of bundle first_bundle+k, 0 if none
+    int tail_amplitude_index; // index of TAILAMP in the local parameters, -1 if none
+    
+  PSFEvaluationSnapshot() : first_fiber(0), first_bundle(0), tail_amplitude_index(-1) {};
+    
+    Trace* TraceOfFiber(int fiber) const {
+      int k = fiber-first_fiber;
+      return (k>=0 && k<int(traces.size())) ? traces[k] : 0;
+    }
+    const PSF_Params* ParamsOfBundle(int bundle) const {
+      int k = bundle-first_bundle;
+      return (k>=0 && k<int(params_of_bundles.size())) ? params_of_bundles[k] : 0;
+    }
+  };
+
+  //! indices of the psf parameters resolved once from their names, see PSF::ParamLayout
+  class PSFParamLayout {
+  public :
+    int nparams;
+    int ghsigx; // -1 if none
+    int ghsigy;
+    int tail_amplitude;
+    int tail_core;
+    int tail_x_scale;
+    int tail_y_scale;
+    int tail_index;
+    std::vector<int> gh_i; // degrees of the GH-i-j parameters, -1 for the others
+    std::vector<int> gh_j;
+    std::vector<bool> linear; // true if the psf is linear in this parameter
+    
+  PSFParamLayout() : nparams(-1), ghsigx(-1), ghsigy(-1), tail_amplitude(-1), tail_core(-1), tail_x_scale(-1), tail_y_scale(-1), tail_index(-1) {};
+    
+    bool IsHermiteCoefficient(int p) const { return gh_i[p]>=0; }
+  };
+
+#ifdef EXTERNAL_TAIL
+  //! tabulated tail profile r2/(c2+r2)*(c2+r2)^(-index/2), with r2=(dx*x_scale)^2+(dy*y_scale)^2,
+  //! on a grid uniform in u=log(1+r/r_scale), linearly interpolated.
+  //! It is a few kB of floats, read-only once built and shared by the copies of a PSF.
+  class TailProfileTable {
+  public :
+    double half_size_x; // profile is zero at or beyond these distances
+    double half_size_y;
+    double x_scale;
+    double y_scale;
+    double r_scale;
+    double inv_r_scale;
+    double inv_du;
+    std::vector<float> values;
+    int peak; // node of the maximum, the values decrease beyond
+    
+    TailProfileTable(const double& r2_core_size, const double& i_x_scale, const double& i_y_scale, const double& power_law_index,
+		     const double& i_half_size_x, const double& i_half_size_y, int n_nodes);
+    
+    double Value(const double& dx, const double &dy) const {
+      if(fabs(dx)>=half_size_x || fabs(dy)>=half_size_y) return 0.;
+      double r = sqrt((dx*x_scale)*(dx*x_scale)+(dy*y_scale)*(dy*y_scale));
+      double u = log(1.+r*inv_r_scale)*inv_du;
+      int k = int(u);
+      if(k>=int(values.size())-1) return values.back();
+      double f = u-k;
+      return values[k]+f*(values[k+1]-values[k]);
+    }
+    double NodeRadius(int k) const { return r_scale*(exp(k/inv_du)-1.); }
+    //! first node beyond which all values are below min_value, values.size() if none
+    int FirstNodeBelow(const double& min_value) const;
+  };
+#endif
+
   class PSF : public std::enable_shared_from_this <PSF> {
 
     // AnalyticPSF* analyticPSF;
@@ -103,10 +229,24 @@ namespace specex {
     
   public :
     double TailProfile(const double& dx, const double &dy, const unbls::vector_double &Params, bool full_calculation=false) const;
+    //! computes the tail profile ahead of the first call to TailProfile (with the default parameters
+    //! or those of the first bundle), so that it is not computed again for each copy of the PSF
+    void PrepareTailProfile(bool with_default_params);
+    void TailSupportHalfSize(double& half_size_x, double& half_size_y) const; // TailProfile is zero beyond this distance
+    //! same, reduced to where |amplitude*TailProfile| >= min_value (if min_value>0 and the profile is computed)
+    void TailSupportHalfSize(double& half_size_x, double& half_size_y, const double& amplitude, const double& min_value) const;
+    //! tail part of PSFValueWithParamsXY (without derivatives)
+    double TailValueWithParamsXY(const double &Xc, const double &Yc, 
+				 const int IPix, const int JPix,
+				 const unbls::vector_double &Params,
+				 bool in_core) const {
+      double prof = TailProfile(IPix-Xc,JPix-Yc,Params,in_core); // sets psf_tail_amplitude_index at first call
+      return Params[psf_tail_amplitude_index]*prof;
+    }
     
   protected :
 
-    specex::image_data r_tail_profile; // to go much faster    
+    std::shared_ptr<const TailProfileTable> r_tail_profile; // to go much faster, shared by the copies of the PSF
     double r2_tail_core_size;
     double r_tail_x_scale;
     double r_tail_y_scale;
@@ -114,6 +254,7 @@ namespace specex {
     
     bool r_tail_profile_must_be_computed;
     void ComputeTailProfile(const unbls::vector_double &Params);
+    void ComputeTailProfile(const unbls::vector_double &Params, const std::vector<std::string>& ParamNames);
     double TailProfileValue(const double& dx, const double &dy) const;
     int psf_tail_amplitude_index;    
     
@@ -143,6 +284,10 @@ public :
     int ParamIndex(const std::string& name) const;
     bool HasParam(const std::string& name) const;
     
+    //! read-only, CompileParamLayout must be called after the parameters are allocated or changed
+    const PSFParamLayout& ParamLayout() const;
+    void CompileParamLayout();
+    
   protected :
     
     //unbls::vector_double TmpParamDer;
@@ -151,6 +296,10 @@ public :
     std::map<int,Legendre1DPol*> XPol; // Legendre1DPol X_vs_W of fibers, data are in FiberTraces
     std::map<int,Legendre1DPol*> YPol; // Legendre1DPol X_vs_W of fibers, data are in FiberTraces
     
+    bool frozen;
+    PSFEvaluationSnapshot snapshot;
+    PSFParamLayout param_layout;
+    
     
   public :
 
@@ -160,6 +309,14 @@ public :
     Trace& GetTrace(int fiber);
     //void AddTrace(int fiber);
     void LoadXYPol();
+    
+    //! fills the evaluation snapshot and computes the tail profile ; after this, the const methods
+    //! that evaluate the PSF (Xccd, Yccd, GetTrace, AllLocalParams..., TailProfile) don't modify it
+    //! and can be called concurrently. to be called again if fibers or bundles are added or removed.
+    void Freeze();
+    void Unfreeze() {frozen = false;}
+    bool Frozen() const {return frozen;}
+    const PSFEvaluationSnapshot& Snapshot() const {return snapshot;}
     double Xccd(int fiber, const double& wave) const;
     double Yccd(int fiber, const double& wave) const;
     
@@ -184,8 +341,32 @@ public :
 		    unbls::vector_double *PosDer = 0,
 		    unbls::vector_double *ParamDer = 0) const;
 
+    //! same as PixValue for a pixel of a stamp prepared with PrepareStampCache
+    virtual double PixValueFromStampCache(const PSFStampCache& cache,
+					  const int IPix, const int JPix,
+					  const unbls::vector_double &Params,
+					  unbls::vector_double *PosDer = 0,
+					  unbls::vector_double *ParamDer = 0) const {return 0;};
+
   public :
 
+    //! precompute the core terms of a spot on the stamp [begin_i,end_i[x[begin_j,end_j[ for a PSF with a separable core ;
+    //! returns false (and an empty cache) if not implemented, in which case PixValue is used
+    virtual bool PrepareStampCache(const double &Xc, const double &Yc,
+				   const int begin_i, const int end_i, const int begin_j, const int end_j,
+				   const unbls::vector_double &Params, bool with_derivatives,
+				   PSFStampCache& cache) const {cache.clear(); return false;};
+    
+    //! PSF core values (without derivatives) of the row JPix of a stamp prepared with PrepareStampCache,
+    //! for all the columns [cache.begin_i,cache.end_i[ of the stamp
+    virtual void RowValuesFromStampCache(const PSFStampCache& cache,
+					 const int JPix,
+					 const unbls::vector_double &Params,
+					 double* values) const {
+      for(int i=cache.begin_i;i<cache.end_i;i++)
+	values[i-cache.begin_i] = PixValueFromStampCache(cache,i,JPix,Params);
+    };
+
     virtual double Profile(const double &X, const double &Y,
 			   const unbls::vector_double &Params,
 			   unbls::vector_double *PosDer = 0,
@@ -246,7 +427,8 @@ public :
     virtual double Degree() const = 0; 
     int BundleNFitPar(int bundle_id) const; // number of parameters to be fitted  needed to describe psf varying with xy ccd coordinates
    
-    bool IsLinear() const; // true if PSF linear wrt PSF params
+    bool IsLinear() const; // true if PSF linear wrt all PSF params
+    bool IsLinear(const std::vector<int>& params) const; // true if PSF linear wrt these PSF params
 
 
     //! Constructor. RI should have been allocated via "new".
@@ -264,7 +446,7 @@ public :
 				const int IPix, const int JPix,
 				const unbls::vector_double &Params,
 				unbls::vector_double *PosDer, unbls::vector_double *ParamDer,
-				bool with_core=true, bool with_tail=true) const;
+				bool with_core=true, bool with_tail=true, const PSFStampCache* stamp_cache=0) const;
     
     double PSFValueWithParamsFW(const int fiber, const double &wave, 
 				const int IPix, const int JPix,
@@ -274,11 +456,18 @@ public :
     
     //! Access to current analytical PSF params (which may depend on position in the frame).
     int GetBundleOfFiber(int fiber) const;
+    const PSF_Params& ParamsOfBundle(int bundle_id) const;
     unbls::vector_double AllLocalParamsFW(const int fiber, const double &wave, int bundle_id=-1) const;
     unbls::vector_double AllLocalParamsXW(const double& x, const double &wave, int bundle_id) const;
     unbls::vector_double AllLocalParamsXW_with_FitBundleParams(const double& x, const double &wave, int bundle_id, const unbls::vector_double& ForThesePSFParams) const;
+    // same as above, filling params (no allocation if params has the right size)
+    void AllLocalParamsXW(const double& x, const double &wave, int bundle_id, unbls::vector_double& params) const;
+    void AllLocalParamsXW_with_FitBundleParams(const double& x, const double &wave, int bundle_id, const unbls::vector_double& ForThesePSFParams, unbls::vector_double& params) const;
     
     virtual void Append(const std::shared_ptr < specex::PSF > other) = 0;
+    //! independent copy of the PSF (traces, tail profile, parameters of bundles), except that
+    //! the polynomials of PSF_Params are shared with this PSF
+    virtual std::shared_ptr < specex::PSF > Clone() const = 0;
     
     ~PSF();
 
@@ -286,6 +475,17 @@ public :
   
   typedef std::shared_ptr < specex::PSF > PSF_p;
   typedef std::weak_ptr   < specex::PSF > PSF_wp;
+  
+  //! freezes a PSF for its lifetime, the PSF is unfrozen when it goes out of scope, also on exceptions
+  class PSFFreezeGuard {
+  public :
+    PSFFreezeGuard(const PSF_p& i_psf) : psf(i_psf) {psf->Freeze();}
+    ~PSFFreezeGuard() {psf->Unfreeze();}
+    PSFFreezeGuard(const PSFFreezeGuard&) = delete;
+    PSFFreezeGuard& operator=(const PSFFreezeGuard&) = delete;
+  private :
+    PSF_p psf;
+  };
 
 };
 
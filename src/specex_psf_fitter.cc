@@ -19,6 +19,7 @@
 #include "specex_unbst.h"
 
 #define SIDE_BAND_WEIGHT_SCALE 10.
+#define NPIX_PER_PANEL 128 // number of pixels buffered before a rank-k update of the psf block of A
 
 using namespace std;
 using namespace specex;
@@ -27,6 +28,12 @@ void specex::PSF_Fitter::SelectFiberBundle(int bundle) {
   std::map<int,PSF_Params>::iterator it = psf->ParamsOfBundles.find(bundle);
   if(it==psf->ParamsOfBundles.end()) SPECEX_ERROR("no such bundle #" << bundle);
   psf_params = & (it->second);
+  
+  // tabulate the traces of the bundle on the rows of the image
+  for(int fiber=psf_params->fiber_min; fiber<=psf_params->fiber_max; fiber++) {
+    std::map<int,specex::Trace>::iterator trace_it = psf->FiberTraces.find(fiber);
+    if(trace_it != psf->FiberTraces.end()) trace_it->second.SetRowTable(0,image.n_rows());
+  }
 }
 
 void specex::PSF_Fitter::SetStampLimitsFromPSF(specex::Stamp& stamp, const specex::PSF_p psf, const double &X, const double &Y) {
@@ -174,7 +181,7 @@ double specex::PSF_Fitter::ParallelizedComputeChi2AB(bool compute_ab) {
     
   }  
   
-#pragma omp parallel for 
+#pragma omp parallel for num_threads(number_of_image_bands)
   for(band=0; band<number_of_image_bands; band++) {
     if(end_j[band]>begin_j[band]) {
        chi2_of_band[band] = ComputeChi2AB(compute_ab,begin_j[band],end_j[band],& A_of_band[band], & B_of_band[band],false);
@@ -204,6 +211,7 @@ void specex::PSF_Fitter::InitTmpData(const vector<specex::Spot_p>& spots) {
   
   // load spot_tmp_data  
   spot_tmp_data.clear();
+  psf_params_bases.clear(); // rebuilt for these spots at the next UpdateTmpData
 
   for(size_t s=0;s<spots.size();s++) {
     const specex::Spot_p spot=spots[s];
@@ -237,6 +245,8 @@ void specex::PSF_Fitter::InitTmpData(const vector<specex::Spot_p>& spots) {
     tmp.stamp = Stamp(image);
     SetStampLimitsFromPSF(tmp.stamp,psf,tmp.x,tmp.y);
     tmp.stamp = tmp.stamp.Intersection(stamp);
+    tmp.support_begin_i = tmp.support_end_i = 0;
+    tmp.support_begin_j = tmp.support_end_j = 0;
         
     tmp.can_measure_flux = true;
     if(spots.size()>1) {
@@ -259,6 +269,11 @@ void specex::PSF_Fitter::InitTmpData(const vector<specex::Spot_p>& spots) {
     
     spot_tmp_data.push_back(tmp);
   }
+  
+  // force the rebuild of the spot index and of the tail image at the next UpdateTmpData
+  spots_of_row_offset.clear();
+  spots_of_row.clear();
+  tail_image_valid = false;
 
 #ifdef EXTERNAL_TAIL
   // compute this before parallel computing
@@ -267,6 +282,24 @@ void specex::PSF_Fitter::InitTmpData(const vector<specex::Spot_p>& spots) {
   
 }
 
+// the tail of a spot is not computed where it is below tail_min_value, so that the sum of the omitted
+// tails of all spots in a pixel is below tail_truncation x the lowest read noise at the spots.
+// called by ComputeWeigthImage, before the model image of the weights and InitTmpData for the same spots.
+void specex::PSF_Fitter::SetTailMinValue(const vector<specex::Spot_p>& spots) {
+  tail_min_value = 0;
+#ifdef EXTERNAL_TAIL
+  if(tail_truncation<=0 || spots.empty()) return;
+  double min_readnoise = 0;
+  for(size_t s=0;s<spots.size();s++) {
+    int i = int(floor(psf->Xccd(spots[s]->fiber,spots[s]->wavelength)+0.5));
+    int j = int(floor(psf->Yccd(spots[s]->fiber,spots[s]->wavelength)+0.5));
+    if(!readnoise.contains(i,j) || readnoise(i,j)<=0) continue;
+    if(min_readnoise==0 || readnoise(i,j)<min_readnoise) min_readnoise = readnoise(i,j);
+  }
+  tail_min_value = tail_truncation*min_readnoise/spots.size();
+#endif
+}
+
 void specex::PSF_Fitter::UpdateTmpData(bool compute_ab) {
 
   
@@ -301,26 +334,384 @@ void specex::PSF_Fitter::UpdateTmpData(bool compute_ab) {
       tmp.x = Params[tmp.x_parameter_index];
       tmp.y = Params[tmp.y_parameter_index];
     }
-    if(fit_psf || fit_psf_tail) {
-      //unbls::vector_double toto = tmp.psf_all_params;
-      tmp.psf_all_params = psf->AllLocalParamsXW_with_FitBundleParams(tmp.x,tmp.wavelength,psf_params->bundle_id,Params);     
+  }
+  
+  if(fit_psf || fit_psf_tail) {
+    // the monomials only change with the spot positions
+    bool update_monomials = ( fit_trace || fit_position );
+    if(psf_params_bases.empty()) {
+      InitPSFParamsBases();
+      update_monomials = true;
     }
-    if(fit_psf && ( fit_trace || fit_position ) && compute_ab) { // need to update at each step monomials
-      int index=0;
-      for(int p=0;p<npar_fixed_coord;p++) {
-	unbls::vector_double legendre_monomials_for_this_psf_parameter = psf_params->FitParPolXW[p]->Monomials(tmp.x,tmp.wavelength);
-	size_t m_size = legendre_monomials_for_this_psf_parameter.size();
-	unbst::subcopy(legendre_monomials_for_this_psf_parameter,tmp.psf_monomials,index);	  
-	index += m_size;
+    UpdatePSFParamsOfSpots(update_monomials);
+  }
+  
+  for(size_t s=0;s<spot_tmp_data.size();s++) {
+    
+    specex::SpotTmpData &tmp = spot_tmp_data[s];
+    
+    if(tmp.ignore) continue;
+    
+    // precompute psf core terms per column and row of the spot stamp
+    bool with_derivatives = compute_ab && (fit_psf || fit_psf_tail || fit_trace || fit_position);
+    psf->PrepareStampCache(tmp.x,tmp.y,tmp.stamp.begin_i,tmp.stamp.end_i,tmp.stamp.begin_j,tmp.stamp.end_j,tmp.psf_all_params,with_derivatives,tmp.stamp_cache);
+  }
+
+  UpdateSpotIndex();
+  UpdateTailImage();
+}
+
+void specex::PSF_Fitter::InitPSFParamsBases() {
+  
+  psf_params_bases.clear();
+  
+  const std::vector<Pol_p>& AP=psf_params->AllParPolXW;
+  const std::vector<Pol_p>& FP=psf_params->FitParPolXW;
+  basis_of_fit_param.assign(FP.size(),-1);
+  
+  // group the parameters per basis, the fitted ones have their coefficients in Params in the order of FitParPolXW
+  size_t fk=0;
+  int index=0;
+  for (size_t ak =0; ak < AP.size(); ++ak) {
+    
+    size_t b=0;
+    for(;b<psf_params_bases.size();b++)
+      if(psf_params_bases[b].pol->SameBasis(*AP[ak])) break;
+    if(b==psf_params_bases.size()) {
+      psf_params_bases.push_back(PSFParamsBasis());
+      psf_params_bases.back().pol = AP[ak];
+    }
+    PSFParamsBasis& basis = psf_params_bases[b];
+    basis.all_params.push_back(int(ak));
+    
+    if((fk<FP.size()) && (AP[ak]==FP[fk])) { // this is a fit param because the addresses are the same
+      basis.fit_index.push_back(index);
+      basis_of_fit_param[fk] = int(b);
+      index += AP[ak]->coeff.size();
+      fk++;
+    }else{
+      basis.fit_index.push_back(-1);
+    }
+  }
+  
+  for(size_t b=0;b<psf_params_bases.size();b++) {
+    PSFParamsBasis& basis = psf_params_bases[b];
+    basis.monomials.resize(basis.pol->Npar(),spot_tmp_data.size());
+    basis.coeffs.resize(basis.all_params.size(),basis.pol->Npar());
+    basis.values.resize(basis.all_params.size(),spot_tmp_data.size());
+  }
+  SPECEX_DEBUG("InitPSFParamsBases " << psf_params_bases.size() << " bases for " << AP.size() << " psf parameters");
+}
+
+void specex::PSF_Fitter::UpdatePSFParamsOfSpots(bool update_monomials) {
+  
+  size_t nspots = spot_tmp_data.size();
+  if(nspots==0) return;
+  
+  unbls::vector_double monomials; // reused for all spots
+  
+  for(size_t b=0;b<psf_params_bases.size();b++) {
+    PSFParamsBasis& basis = psf_params_bases[b];
+    int ncoeff = basis.pol->Npar();
+    
+    if(update_monomials) {
+      for(size_t s=0;s<nspots;s++) {
+	basis.pol->Monomials(spot_tmp_data[s].x,spot_tmp_data[s].wavelength,monomials);
+	std::copy(monomials.begin(),monomials.end(),&basis.monomials(0,s));
+      }
+    }
+    
+    // coefficients of the parameters, from Params for the fitted ones
+    for(size_t k=0;k<basis.all_params.size();k++) {
+      int fit_index = basis.fit_index[k];
+      const unbls::vector_double& coeff = psf_params->AllParPolXW[basis.all_params[k]]->coeff;
+      for(int c=0;c<ncoeff;c++)
+	basis.coeffs(k,c) = (fit_index>=0) ? Params[fit_index+c] : coeff[c];
+    }
+    
+    specex::gemm(1.,basis.coeffs,basis.monomials,0.,basis.values);
+  }
+  
+  size_t nparams = psf_params->AllParPolXW.size();
+  for(size_t s=0;s<nspots;s++) {
+    specex::SpotTmpData &tmp = spot_tmp_data[s];
+    if(tmp.ignore) continue;
+    tmp.psf_all_params.resize(nparams);
+    for(size_t b=0;b<psf_params_bases.size();b++) {
+      const PSFParamsBasis& basis = psf_params_bases[b];
+      for(size_t k=0;k<basis.all_params.size();k++)
+	tmp.psf_all_params[basis.all_params[k]] = basis.values(k,s);
+    }
+  }
+}
+
+// the tail of a spot outside of its core stamp is computed with its frozen flux, it is a fixed image as long as
+// the tail amplitudes and the spot positions do not change (all the fits but those of the tails and traces),
+// computed once instead of at each call of ComputeChi2AB.
+void specex::PSF_Fitter::UpdateTailImage() {
+  
+  bool with_tail_image = false;
+#ifdef EXTERNAL_TAIL
+  with_tail_image = (spot_index_with_tail && !fit_psf_tail);
+#endif
+  if(!with_tail_image) {
+    tail_image_valid = false;
+    return;
+  }
+  
+#ifdef EXTERNAL_TAIL
+  int tail_amplitude_index = psf->ParamLayout().tail_amplitude;
+  vector<double> spots_xya(3*spot_tmp_data.size(),0.);
+  for(size_t s=0;s<spot_tmp_data.size();s++) {
+    const specex::SpotTmpData &tmp = spot_tmp_data[s];
+    if(tmp.ignore) continue;
+    spots_xya[3*s]   = tmp.x;
+    spots_xya[3*s+1] = tmp.y;
+    spots_xya[3*s+2] = tmp.psf_all_params[tail_amplitude_index];
+  }
+  if(tail_image_valid && spots_xya == tail_image_spots) return;
+  tail_image_spots = spots_xya;
+  
+  tail_image.resize_window(stamp.begin_i,stamp.end_i,stamp.begin_j,stamp.end_j);
+  unbls::zero(tail_image.data);
+  
+  bool use_footprint = (spot_tmp_data.size()>1 && footprint_weight.Nx()>0);
+  
+#pragma omp parallel for schedule(dynamic,16) num_threads(max(1,number_of_threads))
+  for(int j=stamp.begin_j;j<stamp.end_j;j++) {
+    if(j<spot_index_begin_j || j>=spot_index_end_j) continue;
+    for(int k=spots_of_row_offset[j-spot_index_begin_j];k<spots_of_row_offset[j-spot_index_begin_j+1];k++) {
+      const specex::SpotTmpData &tmp = spot_tmp_data[spots_of_row[k]];
+      for(int i=max(stamp.begin_i,tmp.support_begin_i);i<min(stamp.end_i,tmp.support_end_i);i++) {
+	if(tmp.stamp.Contains(i,j)) continue;
+	if((use_footprint ? footprint_weight(i,j) : weight(i,j))<=0) continue;
+	tail_image(i,j) += tmp.frozen_flux*psf->TailValueWithParamsXY(tmp.x,tmp.y,i,j,tmp.psf_all_params,false);
+      }
+    }
+  }
+  tail_image_valid = true;
+  SPECEX_DEBUG("UpdateTailImage done");
+#endif
+}
+
+void specex::PSF_Fitter::UpdateSpotIndex() {
+
+  bool with_tail = false;
+#ifdef EXTERNAL_TAIL
+  double tail_half_size_x = 0;
+  double tail_half_size_y = 0;
+  int tail_amplitude_index = psf->ParamLayout().tail_amplitude;
+  with_tail = (fit_psf_tail || (psf_params->AllParPolXW[tail_amplitude_index]->coeff[0]!=0));
+  if(with_tail) psf->TailSupportHalfSize(tail_half_size_x,tail_half_size_y);
+  // the support of tails is not truncated when their amplitude is fit
+  bool truncated_tails = (with_tail && tail_min_value>0 && !fit_psf_tail);
+  double omitted_tail_flux = 0;
+  double spots_flux = 0;
+#endif
+  
+  bool changed = ( spots_of_row_offset.empty() 
+		   || with_tail != spot_index_with_tail 
+		   || spot_index_begin_j != stamp.begin_j 
+		   || spot_index_end_j != stamp.end_j );
+  
+  // support of spots ; only the tail support moves with the spot positions, the core stamps are fixed
+  for(size_t s=0;s<spot_tmp_data.size();s++) {
+    
+    specex::SpotTmpData &tmp = spot_tmp_data[s];
+    
+    int begin_i=0,end_i=0,begin_j=0,end_j=0; // empty if ignored
+    if(!tmp.ignore) {
+      begin_i = tmp.stamp.begin_i;
+      end_i   = tmp.stamp.end_i;
+      begin_j = tmp.stamp.begin_j;
+      end_j   = tmp.stamp.end_j;
+#ifdef EXTERNAL_TAIL
+      if(with_tail) {
+	double half_size_x = tail_half_size_x;
+	double half_size_y = tail_half_size_y;
+	if(truncated_tails) // outside of the core, the tail is computed with the frozen flux
+	  psf->TailSupportHalfSize(half_size_x,half_size_y,tmp.frozen_flux*tmp.psf_all_params[tail_amplitude_index],tail_min_value);
+	begin_i = max(stamp.begin_i,min(begin_i,int(floor(tmp.x-half_size_x))));
+	end_i   = min(stamp.end_i,max(end_i,int(floor(tmp.x+half_size_x))+1));
+	begin_j = max(stamp.begin_j,min(begin_j,int(floor(tmp.y-half_size_y))));
+	end_j   = min(stamp.end_j,max(end_j,int(floor(tmp.y+half_size_y))+1));
+	if(truncated_tails) { // each omitted pixel of the stamp is below tail_min_value
+	  omitted_tail_flux += tail_min_value*(double(stamp.end_i-stamp.begin_i)*(stamp.end_j-stamp.begin_j)-double(end_i-begin_i)*(end_j-begin_j));
+	  spots_flux += fabs(tmp.frozen_flux);
+	}
       }
+#endif
+    }
+    if(begin_i!=tmp.support_begin_i || end_i!=tmp.support_end_i || begin_j!=tmp.support_begin_j || end_j!=tmp.support_end_j) {
+      tmp.support_begin_i = begin_i;
+      tmp.support_end_i   = end_i;
+      tmp.support_begin_j = begin_j;
+      tmp.support_end_j   = end_j;
+      changed = true;
     }
   }
+  
+  if(!changed) return;
 
+#ifdef EXTERNAL_TAIL
+  if(truncated_tails)
+    SPECEX_INFO("PSF tails truncated below " << tail_min_value << " per spot and pixel (" << tail_truncation << " x read noise for all spots), omitted tail flux in the stamp < "
+		<< omitted_tail_flux << " = " << omitted_tail_flux/max(spots_flux,1.e-30) << " of the flux of the spots");
+#endif
+  
+  spot_index_begin_j   = stamp.begin_j;
+  spot_index_end_j     = stamp.end_j;
+  spot_index_with_tail = with_tail;
+  
+  int nrows = max(0,spot_index_end_j-spot_index_begin_j);
+  
+  // count, then fill, keeping spots in increasing order in each row
+  spots_of_row_offset.assign(nrows+1,0);
+  for(size_t s=0;s<spot_tmp_data.size();s++) {
+    const specex::SpotTmpData &tmp = spot_tmp_data[s];
+    for(int j=max(tmp.support_begin_j,spot_index_begin_j);j<min(tmp.support_end_j,spot_index_end_j);j++)
+      spots_of_row_offset[j-spot_index_begin_j+1]++;
+  }
+  for(int r=0;r<nrows;r++)
+    spots_of_row_offset[r+1] += spots_of_row_offset[r];
+  
+  spots_of_row.resize(spots_of_row_offset[nrows]);
+  vector<int> next(spots_of_row_offset.begin(),spots_of_row_offset.end()-1);
+  for(size_t s=0;s<spot_tmp_data.size();s++) {
+    const specex::SpotTmpData &tmp = spot_tmp_data[s];
+    for(int j=max(tmp.support_begin_j,spot_index_begin_j);j<min(tmp.support_end_j,spot_index_end_j);j++)
+      spots_of_row[next[j-spot_index_begin_j]++] = int(s);
+  }
+  
+  SPECEX_DEBUG("UpdateSpotIndex " << spots_of_row.size() << " (spot,row) pairs for " << nrows << " rows, with tail=" << with_tail);
 }
 
 
 
-double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int input_end_j, unbls::matrix_double* input_Ap, unbls::vector_double* input_Bp, bool update_tmp_data) const  {
+// derivatives of the model of a pixel with respect to the fitted parameters (a row of the jacobian).
+// the first n_dense parameters (psf) are shared by all spots and kept dense,
+// the others (traces, continuum, fluxes, positions) are few per pixel and listed in indices.
+struct SparseJacobianRow {
+  unbls::vector_double H; // values, zero for parameters not touched
+  size_t n_dense;
+  bool dense_touched;
+  vector<int> indices; // touched parameters >= n_dense
+  vector<char> touched;
+  
+  void resize(size_t n, size_t i_n_dense) {
+    H.assign(n,0);
+    touched.assign(n,0);
+    indices.clear();
+    n_dense = i_n_dense;
+    dense_touched = false;
+  }
+  void clear() {
+    if(dense_touched) {
+      std::fill(H.begin(),H.begin()+n_dense,0.);
+      dense_touched = false;
+    }
+    for(vector<int>::const_iterator k=indices.begin();k!=indices.end();k++) {
+      H[*k] = 0;
+      touched[*k] = 0;
+    }
+    indices.clear();
+  }
+  void add_dense(const double* vin, size_t n, int out0, double alpha) {
+    double* h = &H[out0];
+    for(size_t k=0;k<n;k++) h[k] += alpha*vin[k];
+    dense_touched = true;
+  }
+  void add(int index, double value) {
+    if(!touched[index]) {
+      touched[index] = 1;
+      indices.push_back(index);
+    }
+    H[index] += value;
+  }
+  void add(const unbls::vector_double& vin, int out0, double alpha) {
+    for(size_t k=0;k<vin.size();k++) add(out0+int(k),alpha*vin[k]);
+  }
+};
+
+// description of a stage of the fit for ComputeChi2ABOfStage : whether A and B are computed
+// and which groups of parameters are fitted. each flag is fixed at compile time to OFF or ON so
+// that the branches of the pixel loop are resolved, or read from the fitter (RUNTIME).
+struct Chi2ABStageFlag {
+  enum {OFF=0, ON=1, RUNTIME=2};
+};
+
+template<int COMPUTE_AB, int FIT_FLUX, int FIT_POSITION, int FIT_PSF, int FIT_TRACE, int FIT_TAIL, int FIT_CONTINUUM> struct Chi2ABStage : public Chi2ABStageFlag {
+  static const int compute_ab    = COMPUTE_AB;
+  static const int fit_flux      = FIT_FLUX;
+  static const int fit_position  = FIT_POSITION;
+  static const int fit_psf       = FIT_PSF;
+  static const int fit_trace     = FIT_TRACE;
+  static const int fit_psf_tail  = FIT_TAIL;
+  static const int fit_continuum = FIT_CONTINUUM;
+};
+
+static inline bool chi2ab_flag(int stage_flag, bool runtime_value) {
+  return (stage_flag==Chi2ABStageFlag::RUNTIME) ? runtime_value : (stage_flag==Chi2ABStageFlag::ON);
+}
+
+// dispatch on the stages of FitEverything, any other combination of fitted parameters is handled at run time
+double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int begin_j, int end_j, unbls::matrix_double* Ap, unbls::vector_double* Bp, bool update_tmp_data) const  {
+  
+  const int OFF = Chi2ABStageFlag::OFF;
+  const int ON  = Chi2ABStageFlag::ON;
+  const int RUN = Chi2ABStageFlag::RUNTIME;
+  
+  // without A and B, the fitted parameters are only used outside of the loop on pixels (priors)
+  if(!compute_ab)
+    return ComputeChi2ABOfStage< Chi2ABStage<OFF,RUN,RUN,RUN,RUN,RUN,RUN> >(false,begin_j,end_j,Ap,Bp,update_tmp_data);
+  
+  int stage = (fit_flux ? 1 : 0) | (fit_position ? 2 : 0) | (fit_psf ? 4 : 0) | (fit_trace ? 8 : 0);
+#ifdef EXTERNAL_TAIL
+  if(fit_psf_tail) stage |= 16;
+#endif
+#ifdef CONTINUUM
+  if(fit_continuum) stage |= 16;
+#endif
+  switch(stage) {
+  case 1 : // fluxes
+    return ComputeChi2ABOfStage< Chi2ABStage<ON,ON,OFF,OFF,OFF,OFF,OFF> >(true,begin_j,end_j,Ap,Bp,update_tmp_data);
+  case 3 : // fluxes and positions
+    return ComputeChi2ABOfStage< Chi2ABStage<ON,ON,ON,OFF,OFF,OFF,OFF> >(true,begin_j,end_j,Ap,Bp,update_tmp_data);
+  case 4 : // psf
+    return ComputeChi2ABOfStage< Chi2ABStage<ON,OFF,OFF,ON,OFF,OFF,OFF> >(true,begin_j,end_j,Ap,Bp,update_tmp_data);
+  case 5 : // psf and fluxes
+    return ComputeChi2ABOfStage< Chi2ABStage<ON,ON,OFF,ON,OFF,OFF,OFF> >(true,begin_j,end_j,Ap,Bp,update_tmp_data);
+  case 8 : // traces
+    return ComputeChi2ABOfStage< Chi2ABStage<ON,OFF,OFF,OFF,ON,OFF,OFF> >(true,begin_j,end_j,Ap,Bp,update_tmp_data);
+  case 9 : // traces and fluxes
+    return ComputeChi2ABOfStage< Chi2ABStage<ON,ON,OFF,OFF,ON,OFF,OFF> >(true,begin_j,end_j,Ap,Bp,update_tmp_data);
+  case 13 : // traces, psf and fluxes
+    return ComputeChi2ABOfStage< Chi2ABStage<ON,ON,OFF,ON,ON,OFF,OFF> >(true,begin_j,end_j,Ap,Bp,update_tmp_data);
+  case 16 : // tails and/or continuum
+    return ComputeChi2ABOfStage< Chi2ABStage<ON,OFF,OFF,OFF,OFF,RUN,RUN> >(true,begin_j,end_j,Ap,Bp,update_tmp_data);
+  default :
+    return ComputeChi2ABOfStage< Chi2ABStage<ON,RUN,RUN,RUN,RUN,RUN,RUN> >(true,begin_j,end_j,Ap,Bp,update_tmp_data);
+  }
+}
+
+template<class Stage> double specex::PSF_Fitter::ComputeChi2ABOfStage(bool runtime_compute_ab, int input_begin_j, int input_end_j, unbls::matrix_double* input_Ap, unbls::vector_double* input_Bp, bool update_tmp_data) const  {
+  
+  // flags of the stage, they hide the members of the fitter and are constants when fixed by Stage
+  const bool compute_ab    = chi2ab_flag(Stage::compute_ab,runtime_compute_ab);
+  const bool fit_flux      = chi2ab_flag(Stage::fit_flux,this->fit_flux);
+  const bool fit_position  = chi2ab_flag(Stage::fit_position,this->fit_position);
+  const bool fit_psf       = chi2ab_flag(Stage::fit_psf,this->fit_psf);
+  const bool fit_trace     = chi2ab_flag(Stage::fit_trace,this->fit_trace);
+#ifdef EXTERNAL_TAIL
+  const bool fit_psf_tail  = chi2ab_flag(Stage::fit_psf_tail,this->fit_psf_tail);
+#else
+  const bool fit_psf_tail  = false;
+#endif
+#ifdef CONTINUUM
+  const bool fit_continuum = chi2ab_flag(Stage::fit_continuum,this->fit_continuum);
+#else
+  const bool fit_continuum = false;
+#endif
   
   int begin_j = input_begin_j;
   int end_j   = input_end_j;
@@ -336,38 +727,30 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
     if(Bp==0) Bp = & const_cast<specex::PSF_Fitter*>(this)->B_of_band[0];
   }
 
-  //===============================================
-#define FASTER_THAN_SYR
-#ifdef FASTER_THAN_SYR  
-
-  vector<int> other_indices;
-  unbls::matrix_double Ablock;
-  vector<unbls::vector_double> Arect;
-  bool do_faster_than_syr = compute_ab && fit_flux && spot_tmp_data.size()>1;
-  if(do_faster_than_syr) {
-    Ablock.resize(index_of_spots_parameters,index_of_spots_parameters);
-    unbls::zero(Ablock);
-    for(size_t s=0; s<spot_tmp_data.size(); s++) {
-      
-      const SpotTmpData& tmp = spot_tmp_data[s];
-      if(tmp.can_measure_flux && !tmp.ignore) {
-	Arect.push_back(unbls::vector_double(index_of_spots_parameters));
-	unbls::zero(Arect.back());
-      }
-    }
-     
-  }
-#endif
-  //=============================================== 
-  
   if(update_tmp_data) const_cast<specex::PSF_Fitter*>(this)->UpdateTmpData(compute_ab);
   
-
-  unbls::vector_double H;  
+  // A is filled with sparse rank-1 updates, except for the dense psf block
+  // accumulated in Adense (lower triangle) and its cross terms with the
+  // other parameters in Across, Across(k,p-n_dense) = A(p,k).
+  // the psf block of sqrt(w)*h is buffered in Hpanel for NPIX_PER_PANEL pixels
+  // and added to Adense with syrk
+  SparseJacobianRow Hrow;
+  unbls::vector_double& H = Hrow.H;
+  unbls::matrix_double Adense;
+  unbls::matrix_double Across;
+  unbls::matrix_double Hpanel;
+  int n_in_panel = 0;
+  size_t n_dense = 0;
   if(compute_ab) {
-    H.resize(nparTot);
-
-    
+    if(fit_psf || fit_psf_tail) n_dense = npar_varying_coord;
+    Hrow.resize(nparTot,n_dense);
+    if(n_dense>0) {
+      Adense.resize(n_dense,n_dense);
+      unbls::zero(Adense.vals);
+      Across.resize(n_dense,nparTot-n_dense);
+      unbls::zero(Across.vals);
+      Hpanel.resize(n_dense,NPIX_PER_PANEL);
+    }
   }
   
   double chi2 = 0;
@@ -377,7 +760,6 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
   unbls::vector_double gradAllPar,gradPos;
   unbls::vector_double *gradAllPar_pointer = 0;
   unbls::vector_double *gradPos_pointer = 0;
-  std::vector<int> indices_of_fitpar_in_allpar;
   
   if(compute_ab) {
     unbls::zero(*Ap);
@@ -386,25 +768,6 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
     if(fit_psf || fit_psf_tail) {
       gradAllPar.resize(psf->LocalNAllPar()); 
       gradAllPar_pointer = &gradAllPar;
-
-      indices_of_fitpar_in_allpar.resize(npar_fixed_coord); 
-
-      const std::vector<Pol_p>& AP=psf_params->AllParPolXW;
-      const std::vector<Pol_p>& FP=psf_params->FitParPolXW;
-
-      // assert(npar_fixed_coord == FP.size()); // ok
-      
-      size_t fk=0;
-      for (size_t ak =0; ak < AP.size(); ++ak) {
-	const Pol_p FPk = FP[fk];
-	const Pol_p APk = AP[ak];
-	if(APk==FPk) {
-	  indices_of_fitpar_in_allpar[fk]=int(ak);
-	  fk++; // change free param index for next iteration
-	  if(fk>=FP.size()) break;
-	}
-      }
-    
     }// will remain zero if (!fit_psf)
     if(fit_position || fit_trace) {gradPos.resize(2); gradPos_pointer = &gradPos;}
 
@@ -412,15 +775,18 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
  
   bool use_footprint = (spot_tmp_data.size()>1 && footprint_weight.Nx()>0);
   
+  // when no derivative is needed, psf core values are computed per row of spot stamps 
+  bool use_row_values = (gradAllPar_pointer==0 && gradPos_pointer==0);
+  vector<double> row_core_values;
+  vector<int> row_core_offset;
+  
 
 #ifdef CONTINUUM
   if(psf_params->fiber_min<psf_params->fiber_min) SPECEX_ERROR("fibers not defined");
   
   unbls::vector_double continuum_params;
-  unbls::vector_double x_of_trace_for_continuum;
-  //unbls::vector_double w_of_trace_for_continuum;
-  double expfact_for_continuum = 0;
-  map<int,unbls::vector_double> continuum_monomials;
+  specex::ContinuumRow continuum_row; // filled for each row
+  vector<const specex::Trace*> traces_for_continuum; // per fiber of bundle, 0 if off
   size_t np_continuum = psf_params->ContinuumPol.coeff.size();
   bool has_continuum  = fit_continuum;
   if(!has_continuum) for(size_t k=0; k<np_continuum; k++) if(psf_params->ContinuumPol.coeff[k]!=0) {has_continuum = true; break;}
@@ -431,29 +797,58 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
     else
       continuum_params = psf_params->ContinuumPol.coeff;
     
-    expfact_for_continuum=1./(sqrt(2*M_PI)*psf_params->continuum_sigma_x);
-    
-    x_of_trace_for_continuum.resize(psf_params->fiber_max-psf_params->fiber_min+1);
+    traces_for_continuum.resize(psf_params->fiber_max-psf_params->fiber_min+1);
+    for(int fiber=psf_params->fiber_min;fiber<=psf_params->fiber_max;fiber++) {
+      const specex::Trace& trace = psf->GetTrace(fiber);
+      traces_for_continuum[fiber-psf_params->fiber_min] = (trace.Off() ? 0 : &trace);
+    }
   }
 #endif
 
+  bool compute_tail = false;
+  bool use_tail_image = false;
+#ifdef EXTERNAL_TAIL
+  compute_tail = (fit_psf_tail || (psf_params->AllParPolXW[psf->ParamLayout().tail_amplitude]->coeff[0]!=0));
+  use_tail_image = (compute_tail && tail_image_valid); // tails outside of the spot cores
+#endif      
+
   for (int j=begin_j; j <end_j; ++j) {
     
-#ifdef CONTINUUM
-    if(has_continuum) {
-      for(int fiber=psf_params->fiber_min;fiber<=psf_params->fiber_max;fiber++) {
-	if(psf->GetTrace(fiber).Off()) continue;
-	x_of_trace_for_continuum[fiber-psf_params->fiber_min] = psf->GetTrace(fiber).X_vs_Y.Value(j);
-	continuum_monomials[fiber]=psf_params->ContinuumPol.Monomials(psf->GetTrace(fiber).W_vs_Y.Value(j));
+    // spots overlapping this row
+    const int* row_spots_begin = 0;
+    const int* row_spots_end = 0;
+    if(j>=spot_index_begin_j && j<spot_index_end_j && !spots_of_row.empty()) {
+      row_spots_begin = &spots_of_row[0] + spots_of_row_offset[j-spot_index_begin_j];
+      row_spots_end   = &spots_of_row[0] + spots_of_row_offset[j-spot_index_begin_j+1];
+    }
+    
+    if(use_row_values) {
+      row_core_offset.resize(row_spots_end-row_spots_begin);
+      int nval=0;
+      for(const int* s=row_spots_begin;s!=row_spots_end;s++) {
+	const PSFStampCache& cache = spot_tmp_data[*s].stamp_cache;
+	int& offset = row_core_offset[s-row_spots_begin];
+	offset = -1;
+	if(cache.Contains(cache.begin_i,j)) {offset = nval; nval += cache.end_i-cache.begin_i;}
+      }
+      row_core_values.resize(nval);
+      for(const int* s=row_spots_begin;s!=row_spots_end;s++) {
+	const specex::SpotTmpData &tmp = spot_tmp_data[*s];
+	int offset = row_core_offset[s-row_spots_begin];
+	if(offset>=0) psf->RowValuesFromStampCache(tmp.stamp_cache,j,tmp.psf_all_params,&row_core_values[offset]);
       }
     }
+
+#ifdef CONTINUUM
+    if(has_continuum)
+      continuum_row.Fill(*psf_params,traces_for_continuum,continuum_params,j,stamp.begin_i,stamp.end_i);
 #endif  
 
     int i1_side_band=0;
     int i2_side_band=0;
     if(increase_weight_of_side_bands && recompute_weight_in_fit) {
-      i1_side_band=int(floor(psf->GetTrace(psf_params->fiber_min).X_vs_Y.Value(double(j))+0.5));
-      i2_side_band=int(floor(psf->GetTrace(psf_params->fiber_max).X_vs_Y.Value(double(j))+0.5));
+      i1_side_band=int(floor(psf->GetTrace(psf_params->fiber_min).XofRow(j)+0.5));
+      i2_side_band=int(floor(psf->GetTrace(psf_params->fiber_max).XofRow(j)+0.5));
     }
     
     for (int i=stamp.begin_i ; i < stamp.end_i; ++i) {
@@ -479,41 +874,35 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
       double res = double(image(i,j));
       double signal = 0;
 
-      if(compute_ab) {
-	unbls::zero(H);
-#ifdef FASTER_THAN_SYR	
-	other_indices.clear();
-#endif
-      }
+      if(compute_ab) Hrow.clear();
 
 #ifdef CONTINUUM
       if(has_continuum) {
 	double continuum_value=0;
-	for(int fiber=psf_params->fiber_min;fiber<=psf_params->fiber_max;fiber++) {
-	  if(psf->GetTrace(fiber).Off()) continue;
-	  double continuum_prof = expfact_for_continuum * exp(-0.5*square((i-x_of_trace_for_continuum[fiber-psf_params->fiber_min])/psf_params->continuum_sigma_x));
-	  continuum_value += specex::dot(continuum_params,continuum_monomials[fiber])*continuum_prof;
+	for(int f=0;f<continuum_row.NFibers();f++) {
+	  if(i<continuum_row.begin_i[f] || i>=continuum_row.end_i[f]) continue;
+	  double continuum_prof = continuum_row.Profile(f,i);
+	  continuum_value += continuum_row.flux[f]*continuum_prof;
 	  if(compute_ab && fit_continuum) {
-	    unbst::subadd(continuum_monomials[fiber],H,continuum_index,continuum_prof);
+	    Hrow.add(continuum_row.monomials[f],continuum_index,continuum_prof);
 	  }
 	}
 	signal += continuum_value;
       }
 #endif
-      bool compute_tail = false;
 #ifdef EXTERNAL_TAIL
-      compute_tail = (fit_psf_tail || (psf_params->AllParPolXW[psf->ParamIndex("TAILAMP")]->coeff[0]!=0));
-#endif      
-      
+      if(use_tail_image) signal += tail_image(i,j);
+#endif
       int nspots_in_pix = 0;
 
       
 
-      for(size_t s=0;s<spot_tmp_data.size();s++) { // loop on tmp spots data
+      for(const int* s=row_spots_begin;s!=row_spots_end;s++) { // loop on tmp spots data overlapping this pixel
 	
-	const specex::SpotTmpData &tmp = spot_tmp_data[s];
-	if (tmp.ignore) continue;
+	const specex::SpotTmpData &tmp = spot_tmp_data[*s];
+	if (i<tmp.support_begin_i || i>=tmp.support_end_i) continue;
 	bool in_core = tmp.stamp.Contains(i,j);
+	if(use_tail_image && !in_core) continue; // no derivative of the tail at fixed frozen flux and amplitude
 
 	//if( (!in_core) && (!fit_psf_tail)  ) continue; // if we fit tails we use the data outside the core, completely wrong, we need tails values everywhere
 		
@@ -521,7 +910,15 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
 	
 
 
-	double psfVal =  psf->PSFValueWithParamsXY(tmp.x,tmp.y, i, j, tmp.psf_all_params, gradPos_pointer, gradAllPar_pointer, in_core, compute_tail); // compute core part of psf only in core
+	double psfVal = 0;
+	if(use_row_values && in_core && row_core_offset[s-row_spots_begin]>=0 && tmp.stamp_cache.Contains(i,j)) {
+	  psfVal = row_core_values[row_core_offset[s-row_spots_begin]+i-tmp.stamp_cache.begin_i];
+#ifdef EXTERNAL_TAIL
+	  if(compute_tail) psfVal += psf->TailValueWithParamsXY(tmp.x,tmp.y, i, j, tmp.psf_all_params, in_core);
+#endif
+	}else{
+	  psfVal = psf->PSFValueWithParamsXY(tmp.x,tmp.y, i, j, tmp.psf_all_params, gradPos_pointer, gradAllPar_pointer, in_core, compute_tail, &tmp.stamp_cache); // compute core part of psf only in core
+	}
 	
 	
 	double flux = tmp.flux;
@@ -541,34 +938,25 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
 	    size_t index = 0;
 	    for(int p=0;p<npar_fixed_coord;p++) {
 	      size_t m_size = psf_params->FitParPolXW[p]->coeff.size();
-	      unbst::subadd(tmp.psf_monomials,index,index+m_size,H,index,flux*gradAllPar[indices_of_fitpar_in_allpar[p]]);
+	      Hrow.add_dense(&psf_params_bases[basis_of_fit_param[p]].monomials(0,*s),m_size,index,flux*gradAllPar[indices_of_fitpar_in_allpar[p]]);
 	      index += m_size;
 	    }
 	  }
 	  //}
 	  if(fit_trace) {
-	    unbst::subadd(tmp.trace_x_monomials,H,tmp.trace_x_parameter_index,gradPos[0]*flux);
-	    unbst::subadd(tmp.trace_y_monomials,H,tmp.trace_y_parameter_index,gradPos[1]*flux);
+	    Hrow.add(tmp.trace_x_monomials,tmp.trace_x_parameter_index,gradPos[0]*flux);
+	    Hrow.add(tmp.trace_y_monomials,tmp.trace_y_parameter_index,gradPos[1]*flux);
 	  }
 	  
 	  if(fit_flux && in_core) {
 	    if(force_positive_flux)
-	      H[tmp.flux_parameter_index] += tmp.flux*psfVal;
+	      Hrow.add(tmp.flux_parameter_index,tmp.flux*psfVal);
 	    else
-	      H[tmp.flux_parameter_index] += psfVal;
-
-#ifdef FASTER_THAN_SYR
-	    if(tmp.can_measure_flux)
-	      other_indices.push_back(tmp.flux_parameter_index);
-#endif
+	      Hrow.add(tmp.flux_parameter_index,psfVal);
 	    }
 	  if(fit_position) {
-	    H[tmp.x_parameter_index] += gradPos[0] * flux;
-	    H[tmp.y_parameter_index] += gradPos[1] * flux;
-#ifdef FASTER_THAN_SYR	    
-	    other_indices.push_back(tmp.x_parameter_index);
-	    other_indices.push_back(tmp.y_parameter_index);
-#endif
+	    Hrow.add(tmp.x_parameter_index,gradPos[0] * flux);
+	    Hrow.add(tmp.y_parameter_index,gradPos[1] * flux);
 	  }
 
 
@@ -599,7 +987,7 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
       }
       
       
-      if(corefootprint_weight_bst>0 && corefootprint.n_rows()>0 && corefootprint(i,j)>0) {
+      if(corefootprint_weight_bst>0 && corefootprint.contains(i,j) && corefootprint(i,j)>0) {
 	wscale *= corefootprint_weight_bst;
 	w *= corefootprint_weight_bst;
       }
@@ -671,65 +1059,51 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
 	    bfact += (1./wscale)*0.5*square(w*res)*(1/psf->gain+2*square(psf->psf_error)*signal);
 	}
 
-	// doing A += w*h*h.transposed();  B += fact*h;
-	//SPECEX_DEBUG("H.size=" << H.size());
-	//SPECEX_DEBUG("Ap->size=" << Ap->size1() << " " << Ap->size2());
-      
-#ifdef FASTER_THAN_SYR
-	if(do_faster_than_syr) {
-	  if(index_of_spots_parameters==0) {
-	    for(vector<int>::const_iterator i=other_indices.begin();i!=other_indices.end();i++) {
-	      const double& hi = H[*i];
-	      double whi = w*hi;
-	      (*Ap)(*i,*i) += whi*hi;
-	      for(vector<int>::const_iterator j=other_indices.begin();j!=i;j++) {
-		(*Ap)(*i,*j) += whi*H[*j];
-	      }
-	    }
-	  } else {
-	    specex::syr(w,H,0,index_of_spots_parameters,Ablock);
-	    
-	    for(vector<int>::const_iterator i=other_indices.begin();i!=other_indices.end();i++) {
-	      const double& hi = H[*i];
-	      double whi = w*hi;
-	      (*Ap)(*i,*i) += whi*hi;
-	      for(vector<int>::const_iterator j=other_indices.begin();j!=i;j++) (*Ap)(*i,*j) += whi*H[*j];
-	      specex::axpy(whi,H,0,index_of_spots_parameters,Arect[*i-index_of_spots_parameters]);
-	    }
+	// doing A += w*h*h.transposed();  B += fact*h; on non-zero entries of h
+	if(Hrow.dense_touched) {
+	  double sqrtw = sqrt(w);
+	  double* Hpanel_col = &Hpanel(0,n_in_panel);
+	  for(size_t k=0;k<n_dense;k++)
+	    Hpanel_col[k] = sqrtw*H[k];
+	  if(++n_in_panel == NPIX_PER_PANEL) {
+	    specex::syrk(1.,Hpanel,1.,Adense);
+	    n_in_panel = 0;
 	  }
-	}else{
-	  specex::syr(w,H,*Ap);
+	  specex::axpy(bfact,H,0,n_dense,*Bp);
 	}
 	
-	specex::axpy(bfact,H,*Bp);
-		
-#else
-	//SPECEX_DEBUG("before filling A and B");
-	specex::syr(w,H,*Ap); //  this is still way too slow; this routine takes advantage of the zeros in h, its faster than sparse matrices
-	//SPECEX_DEBUG("after filling A");
-	specex::axpy(bfact,H,*Bp);
-	//SPECEX_DEBUG("after filling B");
-#endif
-	
+	vector<int>& indices = Hrow.indices;
+	std::sort(indices.begin(),indices.end());
+	for(size_t b=0;b<indices.size();b++) {
+	  int q = indices[b];
+	  double whq = w*H[q];
+	  (*Bp)[q] += bfact*H[q];
+	  for(size_t a=b;a<indices.size();a++) // lower triangle, indices[a]>=q
+	    (*Ap)(indices[a],q) += whq*H[indices[a]];
+	  if(Hrow.dense_touched) {
+	    double* Across_q = &Across(0,q-n_dense);
+	    for(size_t k=0;k<n_dense;k++)
+	      Across_q[k] += whq*H[k];
+	  }
+	}
 	
       } // end of test on compute_ab
       
     } // end of loop on pix coord. i
   } // end of loop on pix coord. j
 
-#ifdef FASTER_THAN_SYR  
-  if(do_faster_than_syr) {
-    size_t n=Ablock.size1();
-    for(size_t j=0;j<n;j++)
-      for(size_t i=j;i<n;i++)
-	(*Ap)(i,j) += Ablock(i,j);
-    for(size_t s=0; s<Arect.size(); s++) {
-      int i = index_of_spots_parameters + s;
-      for(size_t j=0;j<n;j++)
-	(*Ap)(i,j) += Arect[s][j];
-    }
+  if(compute_ab && n_dense>0) {
+    if(n_in_panel>0) { // last partial panel
+      std::fill(Hpanel.vals.begin()+n_in_panel*n_dense,Hpanel.vals.end(),0.);
+      specex::syrk(1.,Hpanel,1.,Adense);
+    }
+    for(size_t j=0;j<n_dense;j++)
+      for(size_t i=j;i<n_dense;i++)
+	(*Ap)(i,j) += Adense(i,j);
+    for(size_t p=n_dense;p<nparTot;p++)
+      for(size_t k=0;k<n_dense;k++)
+	(*Ap)(p,k) += Across(k,p-n_dense);
   }
-#endif
   
   /*
   if(force_positive_flux) {
@@ -928,7 +1302,7 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
 	    
 	    for (size_t c=0; c<c_size; c++, index++) {
 	    
-	      const double& monomial_val = tmp.psf_monomials[index];
+	      const double& monomial_val = psf_params_bases[basis_of_fit_param[fp]].monomials(c,s);
 	      (*Bp)[index]       += monomial_val * prior->hdChi2dx(par);
 	      (*Ap)(index,index) += square(monomial_val) * prior->hd2Chi2dx2(par);
 	    
@@ -948,6 +1322,154 @@ double specex::PSF_Fitter::ComputeChi2AB(bool compute_ab, int input_begin_j, int
   return chi2;
 }
 
+// Solves A*x = B for Gauss-Newton, eliminating the spot parameters (fluxes, positions),
+// indices >= index_of_spots_parameters, with a Schur complement.
+// Spot parameters are only coupled to the parameters of overlapping spots, so A restricted to them
+// is block diagonal with small blocks (groups of overlapping spots), easy to invert.
+// Only the lower half of A is used, A is not modified, and B is replaced by the solution.
+int specex::PSF_Fitter::SolveWithSchurComplement(const unbls::matrix_double& A, unbls::vector_double& B) {
+  
+  int ng = index_of_spots_parameters;
+  int ns = int(nparTot)-ng;
+  
+  solved_with_schur_complement = false;
+  spot_parameter_blocks.clear();
+  spot_block_factor.clear();
+  spot_block_coupling.clear();
+  
+  // groups of coupled spot parameters (union-find on non-zero entries of A)
+  vector<int> root(ns);
+  for(int p=0;p<ns;p++) root[p]=p;
+  for(int q=0;q<ns;q++) {
+    for(int p=q+1;p<ns;p++) {
+      if(A(ng+p,ng+q)==0) continue;
+      int rp=p; while(root[rp]!=rp) rp=root[rp];
+      int rq=q; while(root[rq]!=rq) rq=root[rq];
+      if(rp!=rq) root[max(rp,rq)]=min(rp,rq);
+      root[p]=root[q]=min(rp,rq);
+    }
+  }
+  vector<int> block_of_root(ns,-1);
+  for(int p=0;p<ns;p++) {
+    int r=p; while(root[r]!=r) r=root[r];
+    if(block_of_root[r]<0) {
+      block_of_root[r]=spot_parameter_blocks.size();
+      spot_parameter_blocks.push_back(vector<int>());
+    }
+    spot_parameter_blocks[block_of_root[r]].push_back(ng+p);
+  }
+  
+  // for each group, with D = A(group,group) = L*Lt and C = A(group,global),
+  // accumulate S = Vt*V with V = inv(L)*[C|b] to get the Schur complement
+  // A(global,global) - Ct*inv(D)*C and the corresponding rhs B(global) - Ct*inv(D)*b
+  unbls::matrix_double S(ng+1,ng+1);
+  unbls::zero(S.vals);
+  
+  for(size_t c=0;c<spot_parameter_blocks.size();c++) {
+    const vector<int>& indices = spot_parameter_blocks[c];
+    int nc = indices.size();
+    
+    spot_block_factor.push_back(unbls::matrix_double(nc,nc));
+    unbls::matrix_double& D = spot_block_factor.back();
+    unbls::zero(D.vals);
+    for(int b=0;b<nc;b++)
+      for(int a=b;a<nc;a++)
+	D(a,b) = A(indices[a],indices[b]);
+    int status = cholesky_decompose(D);
+    if(status != 0) {
+      SPECEX_DEBUG("SolveWithSchurComplement cholesky of spot parameters block " << c << " failed with status " << status);
+      return status;
+    }
+    
+    spot_block_coupling.push_back(unbls::matrix_double(nc,ng));
+    unbls::matrix_double& C = spot_block_coupling.back();
+    unbls::matrix_double V(nc,ng+1);
+    for(int a=0;a<nc;a++) {
+      for(int k=0;k<ng;k++)
+	V(a,k) = C(a,k) = A(indices[a],k);
+      V(a,ng) = B[indices[a]];
+    }
+    triangular_solve(D,V);
+    syrk_transposed(1.,V,1.,S);
+  }
+  
+  // solve the reduced system on the global parameters (psf, traces, continuum)
+  unbls::vector_double xg(ng);
+  if(ng>0) {
+    reduced_A_factor.resize(ng,ng);
+    for(int l=0;l<ng;l++) {
+      for(int k=l;k<ng;k++)
+	reduced_A_factor(k,l) = A(k,l)-S(k,l);
+      xg[l] = B[l]-S(ng,l);
+    }
+    int status = cholesky_decompose(reduced_A_factor);
+    if(status != 0) {
+      SPECEX_DEBUG("SolveWithSchurComplement cholesky of reduced matrix failed with status " << status);
+      return status;
+    }
+    cholesky_solve_after_decomposition(reduced_A_factor,xg);
+  }
+  
+  // back-substitution of the spot parameters x(group) = inv(D)*(b - C*x(global))
+  for(size_t c=0;c<spot_parameter_blocks.size();c++) {
+    const vector<int>& indices = spot_parameter_blocks[c];
+    int nc = indices.size();
+    unbls::vector_double xc(nc);
+    for(int a=0;a<nc;a++) xc[a] = B[indices[a]];
+    if(ng>0) specex::gemv(-1.,spot_block_coupling[c],xg,1.,xc);
+    cholesky_solve_after_decomposition(spot_block_factor[c],xc);
+    for(int a=0;a<nc;a++) B[indices[a]] = xc[a];
+  }
+  for(int k=0;k<ng;k++) B[k] = xg[k];
+  
+  solved_with_schur_complement = true;
+  return 0;
+}
+
+// diagonal of the covariance matrix (inverse of A) for the spot parameters, from the last SolveWithSchurComplement
+// variances[p-index_of_spots_parameters] = inv(D) + inv(D)*C*inv(A_reduced)*Ct*inv(D) for each group of spot parameters
+void specex::PSF_Fitter::SpotParameterVariances(unbls::vector_double& variances) const {
+  
+  if(!solved_with_schur_complement) SPECEX_ERROR("SpotParameterVariances needs a call to SolveWithSchurComplement first");
+  
+  int ng = index_of_spots_parameters;
+  variances.resize(nparTot-ng);
+  
+  unbls::matrix_double reduced_covariance;
+  if(ng>0) {
+    reduced_covariance = reduced_A_factor;
+    if (specex::cholesky_invert_after_decomposition(reduced_covariance) != 0) {
+      SPECEX_ERROR("cholesky_invert_after_decomposition failed");
+    }
+    for(int l=0;l<ng;l++)
+      for(int k=l+1;k<ng;k++)
+	reduced_covariance(l,k) = reduced_covariance(k,l);
+  }
+  
+  for(size_t c=0;c<spot_parameter_blocks.size();c++) {
+    const vector<int>& indices = spot_parameter_blocks[c];
+    int nc = indices.size();
+    
+    unbls::matrix_double Dinv = spot_block_factor[c];
+    if (specex::cholesky_invert_after_decomposition(Dinv) != 0) {
+      SPECEX_ERROR("cholesky_invert_after_decomposition failed");
+    }
+    for(int a=0;a<nc;a++) variances[indices[a]-ng] = Dinv(a,a);
+    
+    if(ng==0) continue;
+    
+    unbls::matrix_double G = spot_block_coupling[c]; // inv(D)*C
+    cholesky_solve_after_decomposition(spot_block_factor[c],G);
+    unbls::matrix_double GS(nc,ng);
+    specex::gemm(1.,G,reduced_covariance,0.,GS);
+    for(int a=0;a<nc;a++) {
+      double var = 0;
+      for(int k=0;k<ng;k++) var += GS(a,k)*G(a,k);
+      variances[indices[a]-ng] += var;
+    }
+  }
+}
+
 /*
 static double sign(const double& a, const double& b) {
   if(b>0) return fabs(a);
@@ -964,14 +1486,15 @@ void specex::PSF_Fitter::ComputeWeigthImage(vector<specex::Spot_p>& spots, int*
      - if include_signal_in_weighg, weight account for Poisson signal to noise.
   */
 
+  SetTailMinValue(spots);
+  
   // definition of fitted region of image
   // ----------------------------------------------------
   stamp = compute_stamp(image,psf,spots,0,0,psf_params->bundle_id);
   
   if(spots.size()>1) {
-    // compute psf footprint
-    footprint_weight.resize(weight.Nx(),weight.Ny());
-    unbls::zero(footprint_weight.data);
+    // compute psf footprint, only on the fitted region
+    footprint_weight.resize_window(stamp.begin_i,stamp.end_i,stamp.begin_j,stamp.end_j);
     
     *npix = 0;
     if(include_signal_in_weight) {
@@ -991,7 +1514,7 @@ void specex::PSF_Fitter::ComputeWeigthImage(vector<specex::Spot_p>& spots, int*
       bool modified_tail_amplitude = false;
       unbls::vector_double saved_tail_amplitude_coeff;
       if(fit_psf_tail || fit_continuum) {
-	int index=psf->ParamIndex("TAILAMP");
+	int index=psf->ParamLayout().tail_amplitude;
 	if(psf_params->AllParPolXW[index]->coeff[0]==0) {
 	  saved_tail_amplitude_coeff=psf_params->AllParPolXW[index]->coeff;
 	  psf_params->AllParPolXW[index]->coeff[0]=0.005;
@@ -1000,13 +1523,16 @@ void specex::PSF_Fitter::ComputeWeigthImage(vector<specex::Spot_p>& spots, int*
 	}
       }
       
+      // tails are not truncated while their amplitude is fit, as in UpdateSpotIndex
+      double weight_tail_min_value = (fit_psf_tail ? 0 : tail_min_value);
+      
       // generate error for a reason not understood
-      parallelized_compute_model_image(footprint_weight,weight,psf,spots,only_on_spots,only_psf_core,only_positive,0,0,psf_params->bundle_id);
+      parallelized_compute_model_image(footprint_weight,weight,psf,spots,only_on_spots,only_psf_core,only_positive,0,0,psf_params->bundle_id,number_of_threads,weight_tail_min_value);
       
       //compute_model_image(footprint_weight,weight,psf,spots,only_on_spots,only_psf_core,only_positive,-1,-1,0,0,psf_params->bundle_id);
       
       if(modified_tail_amplitude) {
-	psf_params->AllParPolXW[psf->ParamIndex("TAILAMP")]->coeff = saved_tail_amplitude_coeff;
+	psf_params->AllParPolXW[psf->ParamLayout().tail_amplitude]->coeff = saved_tail_amplitude_coeff;
       }
       
       // compute variance and weight
@@ -1038,8 +1564,8 @@ void specex::PSF_Fitter::ComputeWeigthImage(vector<specex::Spot_p>& spots, int*
 	stamp = compute_stamp(image,psf,spots,0,0,psf_params->bundle_id);
 	for(int j=stamp.begin_j;j<stamp.end_j;j++) {
 	  int margin = min(MAX_X_MARGIN,psf->hSizeX); // 7 is half distance between center of ext. fibers of adjacent bundles
-	  int begin_i = max(stamp.begin_i, int(floor(psf->GetTrace(psf_params->fiber_min).X_vs_Y.Value(double(j))+0.5))-margin);
-	  int end_i   = min(stamp.end_i  , int(floor(psf->GetTrace(psf_params->fiber_max).X_vs_Y.Value(double(j))+0.5))+margin+1);
+	  int begin_i = max(stamp.begin_i, int(floor(psf->GetTrace(psf_params->fiber_min).XofRow(j)+0.5))-margin);
+	  int end_i   = min(stamp.end_i  , int(floor(psf->GetTrace(psf_params->fiber_max).XofRow(j)+0.5))+margin+1);
 	  for(int i=begin_i;i<end_i;i++) {
 	    footprint_weight(i,j)=weight(i,j);
 	  }
@@ -1049,10 +1575,11 @@ void specex::PSF_Fitter::ComputeWeigthImage(vector<specex::Spot_p>& spots, int*
 	  specex::Spot_p& spot= spots[s];
 	  Stamp spot_stamp(image);
 	  SetStampLimitsFromPSF(spot_stamp,psf,spot->xc,spot->yc);
+	  spot_stamp = spot_stamp.Intersection(stamp);
 	  for(int j=spot_stamp.begin_j;j<spot_stamp.end_j;j++) {
 	    int margin = min(MAX_X_MARGIN,psf->hSizeX); // 7 is half distance between center of ext. fibers of adjacent bundles
-	    int begin_i = max(spot_stamp.begin_i, int(floor(psf->GetTrace(psf_params->fiber_min).X_vs_Y.Value(double(j))+0.5))-margin);
-	    int end_i   = min(spot_stamp.end_i  , int(floor(psf->GetTrace(psf_params->fiber_max).X_vs_Y.Value(double(j))+0.5))+margin+1);
+	    int begin_i = max(spot_stamp.begin_i, int(floor(psf->GetTrace(psf_params->fiber_min).XofRow(j)+0.5))-margin);
+	    int end_i   = min(spot_stamp.end_i  , int(floor(psf->GetTrace(psf_params->fiber_max).XofRow(j)+0.5))+margin+1);
 	    for(int i=begin_i;i<end_i;i++) {
 	      footprint_weight(i,j)=weight(i,j);
 	    }
@@ -1078,6 +1605,7 @@ void specex::PSF_Fitter::ComputeWeigthImage(vector<specex::Spot_p>& spots, int*
 	spot_stamp.end_i   = min(spot_stamp.Parent_n_cols(),spot_stamp.end_i);
 	  spot_stamp.begin_j = max(0,spot_stamp.begin_j);
 	  spot_stamp.end_j   = min(spot_stamp.Parent_n_rows(),spot_stamp.end_j);
+	  spot_stamp = spot_stamp.Intersection(stamp);
 	  //SPECEX_INFO("DEBUG " << spots[s]->xc << " " << spots[s]->yc << " " << spot_stamp.begin_i << " " << spot_stamp.end_i << " " << spot_stamp.begin_j << " " << spot_stamp.end_j);
 	  for(int j=spot_stamp.begin_j;j<spot_stamp.end_j;j++) {
 	    for(int i=spot_stamp.begin_i;i<spot_stamp.end_i;i++) {
@@ -1111,12 +1639,12 @@ void specex::PSF_Fitter::ComputeWeigthImage(vector<specex::Spot_p>& spots, int*
       
       int npix_side_band = 0;
       for(int j=stamp.begin_j;j<stamp.end_j;j++) {
-	int i1 = int(floor(psf->GetTrace(psf_params->fiber_min).X_vs_Y.Value(double(j))+0.5));
+	int i1 = int(floor(psf->GetTrace(psf_params->fiber_min).XofRow(j)+0.5));
 	int begin1_i = max(stamp.begin_i,i1-margin);
-	int end1_i   = i1+1;
+	int end1_i   = min(stamp.end_i,i1+1);
 	
-	int i2 = int(floor(psf->GetTrace(psf_params->fiber_max).X_vs_Y.Value(double(j))+0.5));
-	int begin2_i = i2;
+	int i2 = int(floor(psf->GetTrace(psf_params->fiber_max).XofRow(j)+0.5));
+	int begin2_i = max(stamp.begin_i,i2);
 	int end2_i   = min(stamp.end_i,i2+margin+1);
 	
 	for(int i=begin1_i;i<end1_i;i++) {
@@ -1167,6 +1695,22 @@ bool specex::PSF_Fitter::FitSeveralSpots(vector<specex::Spot_p>& spots, double *
   npar_fixed_coord = psf_params->FitParPolXW.size();
   npar_varying_coord = psf->BundleNFitPar(psf_params->bundle_id);
   
+  // resolve once the fitted parameters in AllParPolXW, and the names of the parameters
+  // (ParamLayout is then only read in the parallel sections)
+  psf->CompileParamLayout();
+  indices_of_fitpar_in_allpar.resize(npar_fixed_coord);
+  {
+    const std::vector<Pol_p>& AP=psf_params->AllParPolXW;
+    const std::vector<Pol_p>& FP=psf_params->FitParPolXW;
+    size_t fk=0;
+    for (size_t ak =0; ak < AP.size() && fk < FP.size(); ++ak) {
+      if(AP[ak]==FP[fk]) {
+	indices_of_fitpar_in_allpar[fk]=int(ak);
+	fk++; // change free param index for next iteration
+      }
+    }
+  }
+  
   nparTot  = NPar(spots.size());
 
   ComputeWeigthImage(spots,npix);
@@ -1251,8 +1795,7 @@ bool specex::PSF_Fitter::FitSeveralSpots(vector<specex::Spot_p>& spots, double *
   // ----------------------------------------------------
   
   if(corefootprint_weight_bst>0) {
-    corefootprint = image;
-    unbls::zero(corefootprint.data);
+    corefootprint.resize_window(stamp.begin_i,stamp.end_i,stamp.begin_j,stamp.end_j);
     int core_hsize=2;
     for(size_t s=0;s<spot_tmp_data.size();s++) {
       SpotTmpData& tmp = spot_tmp_data[s];
@@ -1340,17 +1883,6 @@ bool specex::PSF_Fitter::FitSeveralSpots(vector<specex::Spot_p>& spots, double *
       Params[tmp.y_parameter_index] = tmp.y;
       index++;
     }
-    if(fit_psf || fit_psf_tail) {
-      tmp.psf_monomials.resize(npar_varying_coord);
-      // specex::zero(tmp.psf_monomials);
-      int index=0;
-      for(int p=0;p<npar_fixed_coord;p++) {
-	unbls::vector_double legendre_monomials_for_this_psf_parameter = psf_params->FitParPolXW[p]->Monomials(tmp.x,tmp.wavelength);
-	size_t m_size = legendre_monomials_for_this_psf_parameter.size();
-	unbst::subcopy(legendre_monomials_for_this_psf_parameter,tmp.psf_monomials,index);
-	index += m_size;
-	}
-    }    
     // trace monomials
     if(fit_trace) {
       const specex::Trace& trace = psf->FiberTraces[tmp.fiber];
@@ -1373,11 +1905,8 @@ bool specex::PSF_Fitter::FitSeveralSpots(vector<specex::Spot_p>& spots, double *
   ////////////////////////////////////////////////////////////////////////// 
   number_of_image_bands = 1;
   if(parallelized) {
-    char* OMP_NUM_THREADS = getenv("OMP_NUM_THREADS");
-    if(OMP_NUM_THREADS) {
-      number_of_image_bands = atoi(OMP_NUM_THREADS);
-      SPECEX_DEBUG("Using " << number_of_image_bands << " image bands equal to value of OMP_NUM_THREADS");
-    }
+    number_of_image_bands = max(1,number_of_threads);
+    SPECEX_DEBUG("Using " << number_of_image_bands << " image bands");
   }
  
   A_of_band.clear();
@@ -1417,9 +1946,16 @@ bool specex::PSF_Fitter::FitSeveralSpots(vector<specex::Spot_p>& spots, double *
     unbls::matrix_double& A = A_of_band[0];
     unbls::vector_double& B = B_of_band[0];
     
-    unbls::matrix_double As=A;
-
-    int status = cholesky_solve(A,B);
+    unbls::matrix_double As; // copy of A, overwritten by cholesky_solve
+    int status = 0;
+    solved_with_schur_complement = false;
+    if(eliminate_spot_parameters && fit_flux && spot_tmp_data.size()>1) {
+      status = SolveWithSchurComplement(A,B);
+      if(status != 0) As=A;
+    }else{
+      As=A;
+      status = cholesky_solve(A,B);
+    }
     
     SPECEX_DEBUG("specex::PSF_Fitter::FitSeveralSpots solving done");
 
@@ -1459,7 +1995,7 @@ bool specex::PSF_Fitter::FitSeveralSpots(vector<specex::Spot_p>& spots, double *
       SPECEX_DEBUG("specex::PSF_Fitter::FitSeveralSpots linear because only fit flux");
       linear = true;
     }
-    if( (fit_psf) && (!fit_position) && (!fit_trace) && (!fit_flux) && psf->IsLinear()) {
+    if( (fit_psf) && (!fit_position) && (!fit_trace) && (!fit_flux) && psf->IsLinear(indices_of_fitpar_in_allpar)) {
       SPECEX_DEBUG("specex::PSF_Fitter::FitSeveralSpots linear because only fit psf (linear wrt params)");
       linear = true;
     } 
@@ -1636,24 +2172,31 @@ bool specex::PSF_Fitter::FitSeveralSpots(vector<specex::Spot_p>& spots, double *
     
   } // end of minimization loop
     
-  // We have to extract the weight matrix of the psf parameters (the first npar of params vector).
-  //  This involves "marginalization" over the position and flux of the star. Compute 
-  // full covariance matrix (from chi2 second derivatives), extract the psf params sub block,
-  // and invert it back to get a weight matrix
-  
-
-  
-  fitWeight = A_of_band[0];
-  SPECEX_DEBUG("Compute covariance");
-
-  if (specex::cholesky_invert_after_decomposition(fitWeight) != 0) {
-    SPECEX_ERROR("cholesky_invert_after_decomposition failed");
+  // We only need the variances of the fluxes, i.e. the diagonal of the covariance matrix
+  // for the spot parameters, which come last in the parameter vector.
+  unbls::vector_double spot_parameter_variances;
+  if(fit_flux && compute_flux_errors) {
+    SPECEX_DEBUG("Compute variance of spot parameters");
+    if(solved_with_schur_complement) {
+      SpotParameterVariances(spot_parameter_variances);
+    }else{
+      // A_of_band[0] now contains the cholesky factor L of A. The covariance of the spot parameters
+      // is inv(L22*L22t) where L22 is the diagonal block of L for those parameters
+      int ng = index_of_spots_parameters;
+      int ns = int(nparTot)-ng;
+      const unbls::matrix_double& L = A_of_band[0];
+      unbls::matrix_double L22(ns,ns);
+      unbls::zero(L22.vals);
+      for(int b=0;b<ns;b++)
+	for(int a=b;a<ns;a++)
+	  L22(a,b) = L(ng+a,ng+b);
+      if (specex::cholesky_invert_after_decomposition(L22) != 0) {
+	SPECEX_ERROR("cholesky_invert_after_decomposition failed");
+      }
+      spot_parameter_variances.resize(ns);
+      for(int a=0;a<ns;a++) spot_parameter_variances[a] = L22(a,a);
+    }
   }
-  //SPECEX_DEBUG("done cholesky_invert_after_decomposition");
-  
-  // fitWeight is now a covariance matrix
-  // just to avoid confusion :
-  unbls::matrix_double& fitCovmat = fitWeight;
   
   SPECEX_DEBUG("specex::PSF_Fitter::FitSeveralSpots saving fitted params");
   
@@ -1710,20 +2253,18 @@ bool specex::PSF_Fitter::FitSeveralSpots(vector<specex::Spot_p>& spots, double *
     if(fit_flux) {
       if(force_positive_flux) {
 	spot->flux = exp(min(max(Params[tmp.flux_parameter_index],-30.),+30.));
-	double cov = fitCovmat(tmp.flux_parameter_index,tmp.flux_parameter_index);
-	if(cov>=0) {
-	  spot->eflux = spot->flux*sqrt(cov);
-	}else{
-	  SPECEX_ERROR("specex::PSF_Fitter::FitSeveralSpots negative cov = " << cov << " for spot " << s);
-	}
       }else{
 	spot->flux = Params[tmp.flux_parameter_index];
-	double cov = fitCovmat(tmp.flux_parameter_index,tmp.flux_parameter_index);
-	if(cov>=0) {
-	  spot->eflux = sqrt(cov);
-	}else{
+      }
+      if(compute_flux_errors) {
+	double cov = spot_parameter_variances[tmp.flux_parameter_index-index_of_spots_parameters];
+	if(cov<0) {
 	  SPECEX_ERROR("specex::PSF_Fitter::FitSeveralSpots negative cov = " << cov << " for spot " << s);
 	}
+	if(force_positive_flux)
+	  spot->eflux = spot->flux*sqrt(cov);
+	else
+	  spot->eflux = sqrt(cov);
       }
     }
     if(fit_position) {
@@ -1771,7 +2312,7 @@ bool specex::PSF_Fitter::FitSeveralSpots(vector<specex::Spot_p>& spots, double *
 	  
 	  unbls::vector_double spot_params = psf->AllLocalParamsXW_with_FitBundleParams(spot_tmp_data[spot_tmp_data.size()/2].x
 										       ,spot_tmp_data[spot_tmp_data.size()/2].wavelength,psf_params->bundle_id,Params);
-	  SPECEX_INFO("psf tail amplitudes, " << spot_params[psf->ParamIndex("TAILAMP")]);
+	  SPECEX_INFO("psf tail amplitudes, " << spot_params[psf->ParamLayout().tail_amplitude]);
 	}
 #endif
 	
@@ -1827,15 +2368,322 @@ bool specex::PSF_Fitter::FitOneSpot(specex::Spot_p& spot, double *chi2, int *n_i
   return ok;
 };
 
+void specex::PSF_Fitter::InitIsolatedSpot(const specex::Spot_p& spot, specex::SpotTmpData& tmp, specex::Stamp& fit_stamp) {
+  
+  // same as ComputeWeigthImage and InitTmpData for a single spot
+  vector<specex::Spot_p> spots(1,spot);
+  fit_stamp = compute_stamp(image,psf,spots,0,0,psf_params->bundle_id);
+  
+  tmp.ignore = false;
+  tmp.flux = spot->flux;
+  tmp.frozen_flux = tmp.flux;
+  tmp.x    = psf->Xccd(spot->fiber,spot->wavelength);
+  tmp.y    = psf->Yccd(spot->fiber,spot->wavelength);
+  tmp.wavelength   = spot->wavelength;
+  tmp.fiber        = spot->fiber;
+  tmp.fiber_bundle = spot->fiber_bundle;
+  tmp.can_measure_flux = true;
+  
+  tmp.stamp = Stamp(image);
+  SetStampLimitsFromPSF(tmp.stamp,psf,tmp.x,tmp.y);
+  tmp.stamp = tmp.stamp.Intersection(fit_stamp);
+  
+  tmp.psf_all_params = psf->AllLocalParamsXW(tmp.x,tmp.wavelength,psf_params->bundle_id);
+}
+
+void specex::PSF_Fitter::IsolatedSpotStampData(const specex::SpotTmpData& tmp, const specex::Stamp& fit_stamp, std::vector<double>& data, std::vector<double>& w) const {
+  
+  // data minus continuum and weight on fit_stamp, w=0 for pixels ignored in the fit
+  int ni = max(0,fit_stamp.end_i-fit_stamp.begin_i);
+  int nj = max(0,fit_stamp.end_j-fit_stamp.begin_j);
+  data.assign(ni*nj,0.);
+  w.assign(ni*nj,0.);
+  
+  // weight boost of the center of the spot, as with corefootprint in FitSeveralSpots
+  int core_begin_i=0,core_end_i=0,core_begin_j=0,core_end_j=0;
+  if(corefootprint_weight_bst>0) {
+    int core_hsize=2;
+    int iPix = int(floor(tmp.x+0.5));
+    int jPix = int(floor(tmp.y+0.5));
+    core_begin_i = max(iPix-core_hsize,tmp.stamp.begin_i);
+    core_begin_j = max(jPix-core_hsize,tmp.stamp.begin_j);
+    core_end_i   = min(iPix+core_hsize+1,tmp.stamp.end_i);
+    core_end_j   = min(jPix+core_hsize+1,tmp.stamp.end_j);
+  }
+
+#ifdef CONTINUUM
+  bool has_continuum = false;
+  for(size_t k=0; k<psf_params->ContinuumPol.coeff.size(); k++) if(psf_params->ContinuumPol.coeff[k]!=0) {has_continuum = true; break;}
+  specex::ContinuumRow continuum_row; // filled for each row
+  vector<const specex::Trace*> traces_for_continuum; // per fiber of bundle, 0 if off
+  if(has_continuum) {
+    traces_for_continuum.resize(psf_params->fiber_max-psf_params->fiber_min+1);
+    for(int fiber=psf_params->fiber_min;fiber<=psf_params->fiber_max;fiber++) {
+      const specex::Trace& trace = psf->GetTrace(fiber);
+      traces_for_continuum[fiber-psf_params->fiber_min] = (trace.Off() ? 0 : &trace);
+    }
+  }
+#endif
+  
+  for (int j=fit_stamp.begin_j; j <fit_stamp.end_j; ++j) {
+    
+#ifdef CONTINUUM
+    if(has_continuum)
+      continuum_row.Fill(*psf_params,traces_for_continuum,psf_params->ContinuumPol.coeff,j,fit_stamp.begin_i,fit_stamp.end_i);
+#endif
+    
+    for (int i=fit_stamp.begin_i ; i < fit_stamp.end_i; ++i) {
+      
+      double wij = weight(i,j);
+      if (wij<=0) continue;
+      
+      double signal = 0;
+#ifdef CONTINUUM
+      if(has_continuum) {
+	double continuum_value=0;
+	for(int f=0;f<continuum_row.NFibers();f++) {
+	  if(i<continuum_row.begin_i[f] || i>=continuum_row.end_i[f]) continue;
+	  continuum_value += continuum_row.flux[f]*continuum_row.Profile(f,i);
+	}
+	signal += continuum_value;
+      }
+#endif
+      if(i>=core_begin_i && i<core_end_i && j>=core_begin_j && j<core_end_j)
+	wij *= corefootprint_weight_bst;
+      
+      size_t index = size_t(j-fit_stamp.begin_j)*ni+(i-fit_stamp.begin_i);
+      data[index] = double(image(i,j))-signal;
+      w[index] = wij;
+    }
+  }
+}
+
+int specex::PSF_Fitter::FitIsolatedSpotFlux(specex::Spot_p& spot, specex::SpotTmpData& tmp, const specex::Stamp& fit_stamp) const {
+  
+  vector<double> data,w;
+  IsolatedSpotStampData(tmp,fit_stamp,data,w);
+  
+  bool compute_tail = false;
+#ifdef EXTERNAL_TAIL
+  compute_tail = (psf_params->AllParPolXW[psf->ParamLayout().tail_amplitude]->coeff[0]!=0);
+#endif
+  
+  // the psf stamp is rendered once ; the model is linear in the flux so that one Gauss-Newton step from
+  // a null flux gives flux = sum w*d*p / sum w*p^2 , var(flux) = 1 / sum w*p^2 (d = data - continuum, p = psf)
+  const PSFStampCache& cache = tmp.stamp_cache;
+  psf->PrepareStampCache(tmp.x,tmp.y,tmp.stamp.begin_i,tmp.stamp.end_i,tmp.stamp.begin_j,tmp.stamp.end_j,tmp.psf_all_params,false,tmp.stamp_cache);
+  vector<double> row_values(max(1,cache.end_i-cache.begin_i));
+  
+  int ni = fit_stamp.end_i-fit_stamp.begin_i;
+  double chi2 = 0;
+  double sum_wpp = 0;
+  double sum_wdp = 0;
+  for (int j=fit_stamp.begin_j; j <fit_stamp.end_j; ++j) {
+    
+    bool row_in_cache = cache.Contains(cache.begin_i,j);
+    if(row_in_cache) psf->RowValuesFromStampCache(cache,j,tmp.psf_all_params,&row_values[0]);
+    
+    for (int i=fit_stamp.begin_i ; i < fit_stamp.end_i; ++i) {
+      
+      size_t index = size_t(j-fit_stamp.begin_j)*ni+(i-fit_stamp.begin_i);
+      double wij = w[index];
+      if (wij<=0) continue;
+      
+      double res = data[index];
+      chi2 += wij*res*res;
+      
+      if(!tmp.stamp.Contains(i,j)) continue; // the flux is only fit in the core
+      
+      double psfVal = 0;
+      if(row_in_cache && cache.Contains(i,j)) {
+	psfVal = row_values[i-cache.begin_i];
+#ifdef EXTERNAL_TAIL
+	if(compute_tail) psfVal += psf->TailValueWithParamsXY(tmp.x,tmp.y,i,j,tmp.psf_all_params,true);
+#endif
+      }else{
+	psfVal = psf->PSFValueWithParamsXY(tmp.x,tmp.y,i,j,tmp.psf_all_params,0,0,true,compute_tail,&cache);
+      }
+      sum_wdp += wij*res*psfVal;
+      sum_wpp += wij*psfVal*psfVal;
+    }
+  }
+  
+  // chi2 of the starting point, as returned by FitSeveralSpots for a linear fit
+  spot->chi2 = chi2;
+  
+  if(!(sum_wpp>0)) { // cholesky failure
+    spot->chi2 = 1e30;
+    return 1;
+  }
+  double flux = sum_wdp/sum_wpp;
+  if(std::isnan(flux)) {
+    spot->chi2 = 1e30;
+    return 3;
+  }
+  spot->flux = flux;
+  if(compute_flux_errors)
+    spot->eflux = sqrt(1./sum_wpp);
+  return 0;
+}
+
+// solves in place A*x=B for a symmetric positive definite 3x3 matrix given by its lower triangle
+// A = (a00,a10,a11,a20,a21,a22), A is replaced by its cholesky factor L.
+// var0, if not null, is set to inv(A)(0,0). returns a non zero value if A is not positive definite.
+static int cholesky_solve_3x3(double* A, double* B, double* var0=0) {
+  double& l00=A[0]; double& l10=A[1]; double& l11=A[2];
+  double& l20=A[3]; double& l21=A[4]; double& l22=A[5];
+  if(!(l00>0)) return 1;
+  l00 = sqrt(l00);
+  l10 /= l00;
+  l20 /= l00;
+  l11 -= l10*l10;
+  if(!(l11>0)) return 2;
+  l11 = sqrt(l11);
+  l21 = (l21-l20*l10)/l11;
+  l22 -= l20*l20+l21*l21;
+  if(!(l22>0)) return 3;
+  l22 = sqrt(l22);
+  // L*z = B
+  B[0] /= l00;
+  B[1] = (B[1]-l10*B[0])/l11;
+  B[2] = (B[2]-l20*B[0]-l21*B[1])/l22;
+  // L^T*x = z
+  B[2] /= l22;
+  B[1] = (B[1]-l21*B[2])/l11;
+  B[0] = (B[0]-l10*B[1]-l20*B[2])/l00;
+  if(var0) { // inv(A)(0,0) = |inv(L) e0|^2
+    double z0 = 1./l00;
+    double z1 = -l10*z0/l11;
+    double z2 = -(l20*z0+l21*z1)/l22;
+    *var0 = z0*z0+z1*z1+z2*z2;
+  }
+  return 0;
+}
+
+// chi2 of an isolated spot and normal equations for its flux and position, A = lower triangle of the 3x3 matrix
+static double isolated_spot_chi2_ab(const specex::PSF_p& psf, const specex::SpotTmpData& tmp, const specex::Stamp& fit_stamp,
+				    const vector<double>& data, const vector<double>& w, bool compute_tail,
+				    const double& flux, const double& x, const double& y,
+				    specex::PSFStampCache& cache, double* A, double* B) {
+  
+  psf->PrepareStampCache(x,y,tmp.stamp.begin_i,tmp.stamp.end_i,tmp.stamp.begin_j,tmp.stamp.end_j,tmp.psf_all_params,true,cache);
+  unbls::vector_double gradPos(2);
+  
+  for(int k=0;k<6;k++) A[k]=0;
+  for(int k=0;k<3;k++) B[k]=0;
+  
+  int ni = fit_stamp.end_i-fit_stamp.begin_i;
+  double chi2 = 0;
+  for (int j=fit_stamp.begin_j; j <fit_stamp.end_j; ++j) {
+    for (int i=fit_stamp.begin_i ; i < fit_stamp.end_i; ++i) {
+      
+      size_t index = size_t(j-fit_stamp.begin_j)*ni+(i-fit_stamp.begin_i);
+      double wij = w[index];
+      if (wij<=0) continue;
+      
+      double res = data[index];
+      if(tmp.stamp.Contains(i,j)) {
+	double psfVal = psf->PSFValueWithParamsXY(x,y,i,j,tmp.psf_all_params,&gradPos,0,true,compute_tail,&cache);
+	res -= flux*psfVal;
+	double h0 = psfVal;
+	double h1 = flux*gradPos[0];
+	double h2 = flux*gradPos[1];
+	A[0] += wij*h0*h0;
+	A[1] += wij*h1*h0;
+	A[2] += wij*h1*h1;
+	A[3] += wij*h2*h0;
+	A[4] += wij*h2*h1;
+	A[5] += wij*h2*h2;
+	B[0] += wij*res*h0;
+	B[1] += wij*res*h1;
+	B[2] += wij*res*h2;
+      }
+      chi2 += wij*res*res;
+    }
+  }
+  return chi2;
+}
+
+int specex::PSF_Fitter::FitIsolatedSpotFluxAndPosition(specex::Spot_p& spot, specex::SpotTmpData& tmp, const specex::Stamp& fit_stamp) const {
+  
+  // start from the flux at the trace position, otherwise the derivatives wrt position vanish
+  int status = FitIsolatedSpotFlux(spot,tmp,fit_stamp);
+  if(status) return status;
+
+  vector<double> data,w;
+  IsolatedSpotStampData(tmp,fit_stamp,data,w);
+  
+  bool compute_tail = false;
+#ifdef EXTERNAL_TAIL
+  compute_tail = (psf_params->AllParPolXW[psf->ParamLayout().tail_amplitude]->coeff[0]!=0);
+#endif
+  
+  double flux = spot->flux;
+  double x = tmp.x;
+  double y = tmp.y;
+  double A[6],B[3];
+  double next_A[6],next_B[3];
+  double chi2 = isolated_spot_chi2_ab(psf,tmp,fit_stamp,data,w,compute_tail,flux,x,y,tmp.stamp_cache,A,B);
+  
+  for(int iter=0;iter<15;iter++) {
+    
+    double L[6];
+    double delta[3];
+    std::copy(A,A+6,L);
+    std::copy(B,B+3,delta);
+    if(cholesky_solve_3x3(L,delta)!=0) {spot->chi2 = 1e30; return 1;}
+    
+    // the step is halved until the chi2 decreases (in place of the brent line search of FitSeveralSpots)
+    double step = 1;
+    double next_chi2 = chi2;
+    for(int k=0;k<10;k++,step*=0.5) {
+      next_chi2 = isolated_spot_chi2_ab(psf,tmp,fit_stamp,data,w,compute_tail,flux+step*delta[0],x+step*delta[1],y+step*delta[2],tmp.stamp_cache,next_A,next_B);
+      if(next_chi2<=chi2) break;
+    }
+    if(next_chi2>chi2) break; // cannot improve
+    
+    flux += step*delta[0];
+    x    += step*delta[1];
+    y    += step*delta[2];
+    if(std::isnan(flux) || std::isnan(x) || std::isnan(y)) {spot->chi2 = 1e30; return 3;}
+    
+    std::copy(next_A,next_A+6,A);
+    std::copy(next_B,next_B+3,B);
+    double dchi2 = chi2-next_chi2;
+    chi2 = next_chi2;
+    if(dchi2<chi2_precision) break;
+  }
+  
+  // A and B were computed at the current parameters
+  isolated_spot_chi2_ab(psf,tmp,fit_stamp,data,w,compute_tail,flux,x,y,tmp.stamp_cache,A,B);
+  double var = 0;
+  if(cholesky_solve_3x3(A,B,&var)!=0) {spot->chi2 = 1e30; return 1;}
+  
+  spot->flux = flux;
+  spot->xc   = x;
+  spot->yc   = y;
+  spot->chi2 = chi2;
+  if(compute_flux_errors)
+    spot->eflux = sqrt(var);
+  return 0;
+}
+
+// fit results left in the bundle parameters by FitOneSpot on the last spot
+static void set_fit_status_of_isolated_spot(specex::PSF_Params& params, int status, const double& chi2, int nparams) {
+  params.fit_status = status;
+  params.chi2 = chi2;
+  params.nparams = nparams;
+  params.ndata = 0;
+  params.nspots_in_fit = 1;
+}
+
 bool specex::PSF_Fitter::FitIndividualSpotFluxes(std::vector<specex::Spot_p>& spots) {
   
   SPECEX_INFO("fitting independently the flux of each spot");
 
-  // TURN OFF ALL MESSAGES HERE
-  bool saved_debug = specex_is_debug();
-  bool saved_info  = specex_is_verbose();
-  specex_set_debug(false);
-  specex_set_verbose(false);
+  // TURN OFF ALL MESSAGES HERE (of this thread only, other bundles can be fit in parallel)
+  bool saved_quiet = specex_is_thread_quiet();
+  specex_set_thread_quiet(true);
     
   fit_flux                 = true;
   fit_position             = false;
@@ -1855,24 +2703,61 @@ bool specex::PSF_Fitter::FitIndividualSpotFluxes(std::vector<specex::Spot_p>& sp
   
   int nok=0;
   int nfailed=0;
-  for(size_t s=0;s<spots.size();s++) {
-    //std::cout << "fitting " << s << "/" << spots.size() << std::endl;
-    specex::Spot_p& spot = spots[s];    
-    spot->eflux = 0;
-    spot->flux = 0;	
-    spot->status=-1;
+  if(closed_form_spot_fits && !recompute_weight_in_fit) {
+    
+    // positions, stamps and psf parameters are computed serially, the spots are then fit in parallel
+    vector<specex::SpotTmpData> tmp_of_spot(spots.size());
+    vector<specex::Stamp> stamp_of_spot(spots.size(),Stamp(image));
+    for(size_t s=0;s<spots.size();s++) {
+      specex::Spot_p& spot = spots[s];
+      spot->eflux = 0;
+      spot->flux = 0;
+      spot->status=-1;
+      InitIsolatedSpot(spot,tmp_of_spot[s],stamp_of_spot[s]);
+    }
+#ifdef EXTERNAL_TAIL
+    if(!spots.empty()) // compute this before parallel computing
+      psf->TailProfile(0,0,psf->AllLocalParamsFW(spots[0]->fiber,spots[0]->wavelength,spots[0]->fiber_bundle));
+#endif
     
-    bool ok = FitOneSpot(spot);
+    vector<int> status_of_spot(spots.size(),0);
+#pragma omp parallel for schedule(dynamic) num_threads(number_of_threads)
+    for(int s=0;s<int(spots.size());s++)
+      status_of_spot[s] = FitIsolatedSpotFlux(spots[s],tmp_of_spot[s],stamp_of_spot[s]);
     
-    if(ok) {
-      nok++;
-      spot->status=1;
-    }else{
-      spot->status=0;
-      nfailed++;
+    for(size_t s=0;s<spots.size();s++) {
+      if(status_of_spot[s]==0) {
+	nok++;
+	spots[s]->status=1;
+      }else{
+	spots[s]->status=0;
+	nfailed++;
+      }
+    }
+    if(!spots.empty())
+      set_fit_status_of_isolated_spot(*psf_params,status_of_spot.back(),spots.back()->chi2,NPar(1));
+    
+  }else{
+    
+    for(size_t s=0;s<spots.size();s++) {
+      //std::cout << "fitting " << s << "/" << spots.size() << std::endl;
+      specex::Spot_p& spot = spots[s];    
+      spot->eflux = 0;
+      spot->flux = 0;	
+      spot->status=-1;
+      
+      bool ok = FitOneSpot(spot);
       
+      if(ok) {
+	nok++;
+	spot->status=1;
+      }else{
+	spot->status=0;
+	nfailed++;
+	
+      }
+      //if(int(s)%100==0 && s!=0) SPECEX_INFO("done " << s << "/" << spots.size() << " ...");
     }
-    //if(int(s)%100==0 && s!=0) SPECEX_INFO("done " << s << "/" << spots.size() << " ...");
   }
   if(nfailed>0)
     SPECEX_WARNING("fit of flux of " << nfailed << " spots failed");
@@ -1882,8 +2767,7 @@ bool specex::PSF_Fitter::FitIndividualSpotFluxes(std::vector<specex::Spot_p>& sp
   force_positive_flux      = saved_force_positive_flux;
 
   // TURN BACK ALL MESSAGES TO REQUIRED VALUDE
-  specex_set_debug(saved_debug);
-  specex_set_verbose(saved_info);
+  specex_set_thread_quiet(saved_quiet);
   
   return true;
 }
@@ -1899,23 +2783,60 @@ bool specex::PSF_Fitter::FitIndividualSpotPositions(std::vector<specex::Spot_p>&
   fatal                    = false;
   
   int nok=0;
-  for(size_t s=0;s<spots.size();s++) {
-    specex::Spot_p& spot = spots[s];    
-    spot->initial_xc = spot->xc;
-    spot->initial_yc = spot->yc;
-    spot->eflux = 0;
-    spot->flux = 0;	
-    spot->status=-1;
+  if(closed_form_spot_fits && !recompute_weight_in_fit) {
+    
+    vector<specex::SpotTmpData> tmp_of_spot(spots.size());
+    vector<specex::Stamp> stamp_of_spot(spots.size(),Stamp(image));
+    for(size_t s=0;s<spots.size();s++) {
+      specex::Spot_p& spot = spots[s];    
+      spot->initial_xc = spot->xc;
+      spot->initial_yc = spot->yc;
+      spot->eflux = 0;
+      spot->flux = 0;	
+      spot->status=-1;
+      InitIsolatedSpot(spot,tmp_of_spot[s],stamp_of_spot[s]);
+    }
+#ifdef EXTERNAL_TAIL
+    if(!spots.empty()) // compute this before parallel computing
+      psf->TailProfile(0,0,psf->AllLocalParamsFW(spots[0]->fiber,spots[0]->wavelength,spots[0]->fiber_bundle));
+#endif
     
-    bool ok = FitOneSpot(spot);
+    vector<int> status_of_spot(spots.size(),0);
+#pragma omp parallel for schedule(dynamic) num_threads(number_of_threads)
+    for(int s=0;s<int(spots.size());s++)
+      status_of_spot[s] = FitIsolatedSpotFluxAndPosition(spots[s],tmp_of_spot[s],stamp_of_spot[s]);
     
-    if(ok) {
-      nok++;
-      spot->status=1;
-    }else{
-      spot->status=0;
+    for(size_t s=0;s<spots.size();s++) {
+      if(status_of_spot[s]==0) {
+	nok++;
+	spots[s]->status=1;
+      }else{
+	spots[s]->status=0;
+      }
+    }
+    if(!spots.empty())
+      set_fit_status_of_isolated_spot(*psf_params,status_of_spot.back(),spots.back()->chi2,NPar(1));
+    
+  }else{
+    
+    for(size_t s=0;s<spots.size();s++) {
+      specex::Spot_p& spot = spots[s];    
+      spot->initial_xc = spot->xc;
+      spot->initial_yc = spot->yc;
+      spot->eflux = 0;
+      spot->flux = 0;	
+      spot->status=-1;
+      
+      bool ok = FitOneSpot(spot);
+      
+      if(ok) {
+	nok++;
+	spot->status=1;
+      }else{
+	spot->status=0;
+      }
+      if(int(s)%100==0 && s!=0) SPECEX_INFO("done " << s << "/" << spots.size() << " ...");
     }
-    if(int(s)%100==0 && s!=0) SPECEX_INFO("done " << s << "/" << spots.size() << " ...");
   }
   SPECEX_INFO("successful fit of each spot flux+pos for " << nok << "/" << spots.size());
   return true;
@@ -1946,21 +2867,17 @@ void specex::PSF_Fitter::compare_spots_chi2_and_mask(std::vector<specex::Spot_p>
       spot->flux=0;
       spot->status=0;
 
-      // now set weights to zero here
+      // now set weights to zero here (the footprints only cover the last fitted region)
       {
-	Stamp stamp(footprint_weight);
+	Stamp stamp(image);
 	SetStampLimitsFromPSF(stamp,psf,spot->xc,spot->yc);      
-	for (int j=stamp.begin_j;j<stamp.end_j;j++) {
-	  for (int i=stamp.begin_i;i<stamp.end_i;i++) {
+	for (int j=max(stamp.begin_j,footprint_weight.begin_j());j<min(stamp.end_j,footprint_weight.end_j());j++) {
+	  for (int i=max(stamp.begin_i,footprint_weight.begin_i());i<min(stamp.end_i,footprint_weight.end_i());i++) {
 	    footprint_weight(i,j)=0;
 	  }
 	}
-      }
-      {
-	Stamp stamp(corefootprint);
-	SetStampLimitsFromPSF(stamp,psf,spot->xc,spot->yc);      
-	for (int j=stamp.begin_j;j<stamp.end_j;j++) {
-	  for (int i=stamp.begin_i;i<stamp.end_i;i++) {
+	for (int j=max(stamp.begin_j,corefootprint.begin_j());j<min(stamp.end_j,corefootprint.end_j());j++) {
+	  for (int i=max(stamp.begin_i,corefootprint.begin_i());i<min(stamp.end_i,corefootprint.end_i());i++) {
 	    corefootprint(i,j)=0;
 	  }
 	}
@@ -2187,7 +3104,7 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
       int end_j   = min(int(weight.n_rows()),int(floor(trace.Y_vs_W.Value(trace.Y_vs_W.xmax)))+1);
       int ndead=0;
       for(int j=begin_j;j<end_j;j++) {
-	int i_center = trace.X_vs_Y.Value(double(j));
+	int i_center = trace.XofRow(j);
 	int begin_i = max(0,i_center-3);
 	int end_i   = min(int(weight.n_cols()),i_center+4);
 	for(int i = begin_i ;i<end_i;i++) {
@@ -2365,6 +3282,8 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
 #endif
   } // end of test of init psf
 
+  // from here the fibers and bundles of the PSF don't change, evaluate it from read-only tables
+  specex::PSFFreezeGuard freeze_guard(psf);
   
   for(map<string,Prior*>::const_iterator it=priors.begin(); it!=priors.end(); ++it) {
     SPECEX_INFO("Setting Gaussian prior on param " << it->first);
@@ -2558,7 +3477,9 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
 	fit_position   = false;
 	fit_psf        = false;
 	fit_trace      = true;
+	compute_flux_errors = false; // fluxes are refit with FitIndividualSpotFluxes afterwards
 	ok = FitSeveralSpots(selected_spots,&chi2,&npix,&niter);
+	compute_flux_errors = true;
 	if(!ok) SPECEX_ERROR("FitSeveralSpots failed for FLUX+TRACE");
 	
 	
@@ -2601,14 +3522,10 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
       SPECEX_INFO("Choose the parameters that participate to the fit : only gaussian terms");
       //unbls::zero(psf_params->FitParPolXW);
       psf_params->FitParPolXW.clear();
+      const specex::PSFParamLayout& layout = psf->ParamLayout();
       int npar = psf->LocalNAllPar();
       for(int p=0;p<npar;p++) {
-	const string& name = psf->ParamName(p);
-	bool ok = false;
-	ok |= (name=="GHSIGX" || name=="GHSIGY" || name=="RADIUS"  || name=="SIGMA" );
-	//ok |= (name=="GHSIGX2");
-	//ok |= (name=="GHSIGY2");
-	//ok |= (name=="GHSCAL2");
+	bool ok = (p==layout.ghsigx || p==layout.ghsigy);
 	if(ok)
 	  psf_params->FitParPolXW.push_back(psf_params->AllParPolXW[p]);
       }
@@ -2642,7 +3559,9 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
     fit_position   = false;
     fit_psf        = true;
     fit_trace      = false;
+    compute_flux_errors = false; // fluxes are refit with FitIndividualSpotFluxes afterwards
     ok = FitSeveralSpots(selected_spots,&chi2,&npix,&niter);
+    compute_flux_errors = true;
     if(!ok) SPECEX_ERROR("FitSeveralSpots failed for PSF+FLUX");
     
   }
@@ -2678,8 +3597,7 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
       //unbls::zero(psf_params->FitParPolXW);
       psf_params->FitParPolXW.clear();
       for(int p=0;p<psf->LocalNAllPar();p++) {
-	const string& name = psf->ParamName(p);
-	ok = (name=="TAILAMP");
+	ok = (p==psf->ParamLayout().tail_amplitude);
 	if(ok)
 	  psf_params->FitParPolXW.push_back(psf_params->AllParPolXW[p]);
       }
@@ -2698,13 +3616,7 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
     {
       psf_params->FitParPolXW.clear();
       for(int p=0;p<psf->LocalNAllPar();p++) {
-	const string& name = psf->ParamName(p);
-	ok = true;
-	ok &= (name!="GHSIGX" && name!="GHSIGY" && name!="GHNSIG");
-	ok &= (name!="GHSIGX2" && name!="GHSIGY2" && name!="GHSCAL2");
-	//ok &= (name!="RADIUS" && name!="SIGMA");
-	ok &= (name!="RADIUS");
-	ok &= (name!="TAILAMP" && name!="TAILCORE" && name!="TAILXSCA" && name!="TAILYSCA" && name!="TAILINDE");
+	ok = psf->ParamLayout().IsHermiteCoefficient(p); // not the gaussian sigmas nor the tail
 	if(ok)
 	  psf_params->FitParPolXW.push_back(psf_params->AllParPolXW[p]);
       }
@@ -2716,12 +3628,7 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
   {
     psf_params->FitParPolXW.clear();
     for(int p=0;p<psf->LocalNAllPar();p++) {
-      const string& name = psf->ParamName(p);
-      ok = true;
-      ok &= (name!="GHSIGX" && name!="GHSIGY" && name!="GHNSIG");
-      ok &= (name!="GHSIGX2" && name!="GHSIGY2" && name!="GHSCAL2");
-      ok &= (name!="RADIUS" && name!="SIGMA");
-      ok &= (name!="TAILAMP" && name!="TAILCORE" && name!="TAILXSCA" && name!="TAILYSCA" && name!="TAILINDE");
+      ok = psf->ParamLayout().IsHermiteCoefficient(p); // not the gaussian sigmas nor the tail
       if(ok)
 	psf_params->FitParPolXW.push_back(psf_params->AllParPolXW[p]);
     }
@@ -2752,8 +3659,7 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
     if(scheduled_fit_of_psf_tail || scheduled_fit_of_continuum) {
       psf_params->FitParPolXW.clear();
       for(int p=0;p<psf->LocalNAllPar();p++) {
-	const string& name = psf->ParamName(p);
-	ok = (name=="TAILAMP");
+	ok = (p==psf->ParamLayout().tail_amplitude);
 	if(ok)
 	  psf_params->FitParPolXW.push_back(psf_params->AllParPolXW[p]);
       }
@@ -2774,13 +3680,7 @@ bool specex::PSF_Fitter::FitEverything(std::vector<specex::Spot_p>& input_spots,
       {
 	psf_params->FitParPolXW.clear();
 	for(int p=0;p<psf->LocalNAllPar();p++) {
-	  const string& name = psf->ParamName(p);
-	  ok = true;
-	  ok &= (name!="GHSIGX" && name!="GHSIGY" && name!="GHNSIG");
-	  ok &= (name!="GHSIGX2" && name!="GHSIGY2" && name!="GHSCAL2");
-	  //ok &= (name!="RADIUS" && name!="SIGMA");
-	  ok &= (name!="RADIUS");
-	  ok &= (name!="TAILAMP" && name!="TAILCORE" && name!="TAILXSCA" && name!="TAILYSCA" && name!="TAILINDE");
+	  ok = psf->ParamLayout().IsHermiteCoefficient(p); // not the gaussian sigmas nor the tail
 	  if(ok)
 	    psf_params->FitParPolXW.push_back(psf_params->AllParPolXW[p]);
 	}
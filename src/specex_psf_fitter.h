@@ -25,7 +25,6 @@ namespace specex {
     
     unbls::vector_double trace_x_monomials;
     unbls::vector_double trace_y_monomials;
-    unbls::vector_double psf_monomials;
     unbls::vector_double psf_all_params;
     
     int flux_parameter_index;
@@ -42,11 +41,34 @@ namespace specex {
 
 
     Stamp stamp;
+    PSFStampCache stamp_cache; // separable psf core terms on stamp
+
+    // pixels where this spot contributes to the model (core stamp, or tail support)
+    int support_begin_i;
+    int support_end_i;
+    int support_begin_j;
+    int support_end_j;
 
     bool can_measure_flux;
     bool ignore;
   };
 
+  // psf parameters of a bundle whose polynomials share the same basis of monomials of (x,wave),
+  // with the monomials of all the spots of a fit (one column per spot), so that the parameters of all
+  // spots are obtained with a single matrix product values = coeffs x monomials.
+  class PSFParamsBasis {
+    
+  public :
+    
+    Pol_p pol; // one of the polynomials, defines the basis
+    std::vector<int> all_params; // indices of the parameters in AllParPolXW
+    std::vector<int> fit_index;  // index of the first coefficient of the parameters in the fitted parameters, -1 if fixed
+    
+    unbls::matrix_double monomials; // ncoeff x nspots
+    unbls::matrix_double coeffs;    // nparams x ncoeff
+    unbls::matrix_double values;    // nparams x nspots
+  };
+
 class PSF_Fitter {
 
  private :
@@ -54,22 +76,48 @@ class PSF_Fitter {
   // internal to fitseveralspots
   unsigned npar_fixed_coord;
   unsigned npar_varying_coord;
+  std::vector<int> indices_of_fitpar_in_allpar; // index in AllParPolXW of FitParPolXW[p]
   unsigned npar_trace;
   size_t nparTot;
   int index_of_spots_parameters;
   
   std::vector<SpotTmpData> spot_tmp_data;
 
+  // psf parameters and their monomials for the spots of spot_tmp_data, see UpdatePSFParamsOfSpots
+  std::vector<PSFParamsBasis> psf_params_bases;
+  std::vector<int> basis_of_fit_param; // index in psf_params_bases of FitParPolXW[p]
+
+  // row-bucketed (CSR) index of the spots overlapping each row of the fit stamp
+  // spots_of_row[spots_of_row_offset[j-spot_index_begin_j]:spots_of_row_offset[j-spot_index_begin_j+1]]
+  std::vector<int> spots_of_row_offset;
+  std::vector<int> spots_of_row;
+  int spot_index_begin_j;
+  int spot_index_end_j;
+  bool spot_index_with_tail;
+  double tail_min_value; // tails of spots are not computed below this value, set from tail_truncation in SetTailMinValue
+  
+  // sum of the tails of the spots outside of their core when the tails are not fit, see UpdateTailImage
+  image_data tail_image;
+  bool tail_image_valid;
+  std::vector<double> tail_image_spots; // x, y and tail amplitude of the spots of tail_image
+
 #ifdef CONTINUUM
   size_t continuum_index;
 #endif
 
+  // elimination of the spot parameters (fluxes, positions) with a Schur complement,
+  // saved from the last call to SolveWithSchurComplement
+  std::vector<std::vector<int> > spot_parameter_blocks; // groups of coupled spot parameters
+  std::vector<unbls::matrix_double> spot_block_factor; // cholesky factor of A restricted to a group
+  std::vector<unbls::matrix_double> spot_block_coupling; // A(group,global parameters)
+  unbls::matrix_double reduced_A_factor; // cholesky factor of the Schur complement on the global parameters
+  bool solved_with_schur_complement;
+
  public :
   // internal set of parameters and matrices
   unbls::vector_double Params; // parameters that are fit (PSF, fluxes, XY CCD positions)
   std::vector<unbls::matrix_double> A_of_band; // for Gauss-Newton solving
   std::vector<unbls::vector_double> B_of_band; // for Gauss-Newton solving
-  unbls::matrix_double fitWeight; // saved weight matrix of fitter parameters
   
  public :
   
@@ -83,12 +131,14 @@ class PSF_Fitter {
   void SelectFiberBundle(int bundle); // this sets bundle_id and psf_global_params
 
 
-  int number_of_image_bands; // for parallel processing (automatically set = to the variable OMP_NUM_THREADS of openmp)
+  int number_of_image_bands; // for parallel processing (set to number_of_threads)
 
   const image_data& image;
   const image_data& weight;
   const image_data& readnoise;
-  image_data footprint_weight; // weight x psf footprint for global fit
+  // weight x psf footprint for global fit, and pixels at the center of spots,
+  // both are windows of the image covering the stamp of the last fit (reused from fit to fit)
+  image_data footprint_weight;
   image_data corefootprint;  
   Stamp stamp; // rectangle in image where the fit occurs
   
@@ -103,6 +153,7 @@ class PSF_Fitter {
 #ifdef EXTERNAL_TAIL
   bool fit_psf_tail;
   bool scheduled_fit_of_psf_tail;
+  double tail_truncation; // tails of spots are not computed where the sum of the omitted tails is below this fraction of the read noise (0 = never truncated)
 #endif
 #ifdef CONTINUUM
   bool fit_continuum;
@@ -111,6 +162,9 @@ class PSF_Fitter {
   bool scheduled_fit_with_weight_model;
   bool sparse_pol;
   bool direct_simultaneous_fit;
+  bool eliminate_spot_parameters; // solve with a Schur complement on the spot parameters when fitting fluxes
+  bool compute_flux_errors; // set spot eflux in FitSeveralSpots when fitting fluxes
+  bool closed_form_spot_fits; // FitIndividualSpotFluxes/Positions solve each spot directly instead of calling FitOneSpot
   bool write_tmp_results;
   int trace_prior_deg;
   
@@ -121,6 +175,7 @@ class PSF_Fitter {
   bool increase_weight_of_side_bands;
   bool fatal;
   bool parallelized;
+  int number_of_threads; // number of image bands computed in parallel
   double polynomial_degree_along_x;
   double polynomial_degree_along_wave;
   
@@ -156,6 +211,7 @@ class PSF_Fitter {
 #ifdef EXTERNAL_TAIL
     fit_psf_tail(false),
     scheduled_fit_of_psf_tail(false),
+    tail_truncation(0),
 #endif
 #ifdef CONTINUUM
     fit_continuum(false),
@@ -164,15 +220,25 @@ class PSF_Fitter {
     scheduled_fit_with_weight_model(false),
     sparse_pol(true),
     direct_simultaneous_fit(false),
+    eliminate_spot_parameters(true),
+    compute_flux_errors(true),
+    closed_form_spot_fits(true),
     write_tmp_results(false),
     trace_prior_deg(0),
     fatal(true),
     parallelized(true),        
+    number_of_threads(1),
     polynomial_degree_along_x(1),
     polynomial_degree_along_wave(4),
     max_number_of_lines(0)
 
       {
+	spot_index_begin_j = 0;
+	spot_index_end_j = 0;
+	spot_index_with_tail = false;
+	tail_min_value = 0;
+	tail_image_valid = false;
+	solved_with_schur_complement = false;
       };
     
     void SetStampLimitsFromPSF(Stamp& stamp, const PSF_p psf, const double &X, const double &Y);
@@ -183,13 +249,29 @@ class PSF_Fitter {
    //int Index_Flux(int spotid, int nspots) const;
     
     void InitTmpData(const std::vector<Spot_p>& spots);
+    void SetTailMinValue(const std::vector<Spot_p>& spots);
     void UpdateTmpData(bool compute_ab);
+    void InitPSFParamsBases();
+    void UpdatePSFParamsOfSpots(bool update_monomials);
+    void UpdateSpotIndex();
+    void UpdateTailImage();
     double ParallelizedComputeChi2AB(bool compute_ab);
     double ComputeChi2AB(bool compute_ab, int begin_j=0, int end_j=0, unbls::matrix_double* Ap=0, unbls::vector_double* Bp=0, bool update_tmp_data=true) const;
+    template<class Stage> double ComputeChi2ABOfStage(bool compute_ab, int begin_j, int end_j, unbls::matrix_double* Ap, unbls::vector_double* Bp, bool update_tmp_data) const; // ComputeChi2AB specialized for a stage of the fit
+    int SolveWithSchurComplement(const unbls::matrix_double& A, unbls::vector_double& B);
+    void SpotParameterVariances(unbls::vector_double& variances) const; // after SolveWithSchurComplement, for params >= index_of_spots_parameters
 
   void ComputeWeigthImage(std::vector<specex::Spot_p>& spots, int* npix);
 
   bool FitOneSpot(Spot_p& spot, double *chi2_val=0, int *n_iterations=0);
+
+  // fits of a single spot at fixed psf without FitSeveralSpots (same model, weights and chi2 as FitOneSpot).
+  // InitIsolatedSpot must be called serially, the fits only read the fitter and the psf so that
+  // spots can be fit in parallel. they return 0 if ok, else the fit_status of FitSeveralSpots.
+  void InitIsolatedSpot(const Spot_p& spot, SpotTmpData& tmp, Stamp& fit_stamp);
+  void IsolatedSpotStampData(const SpotTmpData& tmp, const Stamp& fit_stamp, std::vector<double>& data, std::vector<double>& w) const;
+  int FitIsolatedSpotFlux(Spot_p& spot, SpotTmpData& tmp, const Stamp& fit_stamp) const;
+  int FitIsolatedSpotFluxAndPosition(Spot_p& spot, SpotTmpData& tmp, const Stamp& fit_stamp) const;
   bool FitSeveralSpots(std::vector<Spot_p>& spots, double *chi2_val=0, int *n_pixels=0, int *n_iterations=0);
   
   bool FitIndividualSpotFluxes(std::vector<Spot_p>& spots);
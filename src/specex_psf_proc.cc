@@ -65,8 +65,8 @@ void _load_trace(specex::PSF_p psf, bool is_x) {
 	  unbls::vector_double x(pol->coeff.size());
 	  for(int i=0;i<pol->coeff.size();i++) {
 	    wave[i]=WAVEMIN+i*((WAVEMAX-WAVEMIN)/(pol->coeff.size()-1));
-	    x[i]=pol->Value(wave[i]);
 	  }
+	  pol->Values(wave,x);
 	  specex::Legendre1DPol npol(pol->coeff.size()-1,WAVEMIN,WAVEMAX);
 	  npol.Fit(wave,x,0,false);
 	  for(int c=0;c<npol.coeff.size();c++)
@@ -183,6 +183,7 @@ void _load_psf(specex::PSF_p psf) {
   
   unbls::vector_double coeff(ncoeff*NFIBERS);
   unbls::vector_double values(ncoeff);
+  unbls::vector_double x_of_wave(ncoeff);
   
   bool need_to_add_first_gh = true;
   for(int p=0;p<nparams;p++) {  // loop on all PSF parameters      
@@ -213,9 +214,8 @@ void _load_psf(specex::PSF_p psf) {
 	
 	// build a Legendre1DPol out of the Legendre2DPol
 	specex::Legendre1DPol pol1d(ncoeff-1,WAVEMIN,WAVEMAX);
-	for(int w=0;w<ncoeff;w++) {
-	  values[w] = pol2d->Value(trace.X_vs_W.Value(wave[w]),wave[w]);
-	}
+	trace.X_vs_W.Values(wave,x_of_wave);
+	pol2d->Values(x_of_wave,wave,values);
 	pol1d.Fit(wave,values,0,false);
 	
 	// now copy parameters;	
@@ -32,6 +32,10 @@ using namespace specex;
 #endif
 #include <portable_fenv.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /*
   input format of fits file
   HDU 0 : blank
@@ -105,59 +109,26 @@ int specex::PyFitting::fit_psf(
   // main body
   
   try {
-    // init PSF fitter
-    // -------------------------------------------- 
-    PSF_Fitter fitter(psf,pymg.image,pymg.weight,pymg.rdnoise);
-    
-    fitter.polynomial_degree_along_x    = opts.legendre_deg_x;
-    fitter.polynomial_degree_along_wave = opts.legendre_deg_wave;
-    fitter.psf->psf_error               = opts.psf_error;
-    fitter.corefootprint_weight_bst     = opts.psf_core_wscale;
-    fitter.write_tmp_results            = opts.write_tmp_results;
-    fitter.trace_prior_deg              = opts.trace_prior_deg;
-    
-#ifdef EXTERNAL_TAIL
-    fitter.scheduled_fit_of_psf_tail    = opts.fit_psf_tails;
-#endif
-
-#ifdef CONTINUUM
-    fitter.scheduled_fit_of_continuum   = opts.fit_continuum;
-#endif
-
-    fitter.scheduled_fit_with_weight_model  = opts.use_variance_model;
     
-    fitter.scheduled_fit_of_traces      = opts.fit_traces;
-    fitter.scheduled_fit_of_sigmas      = opts.fit_sigmas;
-    fitter.scheduled_fit_of_psf         = opts.fit_thepsf;
-    fitter.direct_simultaneous_fit      = true; // use_input_specex_psf;
-    fitter.max_number_of_lines          = opts.max_number_of_lines;
+    psf->psf_error     = opts.psf_error;
+    psf->gain          = 1; // images are already in electrons
+    psf->readout_noise = 0; // readnoise is a property of image, not PSF
     
-    fitter.psf->gain = 1; // images are already in electrons
-    fitter.psf->readout_noise = 0; // readnoise is a property of image, not PSF
-        
     if(pymg.header.find("CAMERA") != pymg.header.end()) {
-      fitter.psf->camera_id = pymg.header["CAMERA"];
-      SPECEX_INFO("CAMERA = " << fitter.psf->camera_id );
+      psf->camera_id = pymg.header["CAMERA"];
+      SPECEX_INFO("CAMERA = " << psf->camera_id );
     }else{
       SPECEX_WARNING("CAMERA Id not found in header");
     }
     
-    fitter.priors = pypr.priors;
-        
-    fitter.mask.Clear();
-
     SPECEX_INFO(
 		"PSF '" << opts.psf_model << "' stamp size = " 
 		<< psf->hSizeX << "x" << psf->hSizeY );    
     
-    int first_fitted_fiber=-1;
-    int last_fitted_fiber=-1;
-    
-    // loop on fiber bundles 
+    // allocate bundles in PSF if necessary
     // -------------------------------------------- 
     for(int bundle = opts.first_fiber_bundle; bundle <= opts.last_fiber_bundle ; bundle ++) {
-    
-      // allocate bundle in PSF if necessary
+      
       if(psf->ParamsOfBundles.find(bundle)==psf->ParamsOfBundles.end()) {
 	psf->ParamsOfBundles[bundle] = specex::PSF_Params();
 	psf->ParamsOfBundles[bundle].bundle_id = bundle;
@@ -174,78 +145,201 @@ int specex::PyFitting::fit_psf(
 	psf->ParamsOfBundles[bundle].fiber_max = opts.last_fiber;
 	SPECEX_INFO("restricting fiber range last fiber = " << opts.last_fiber);
       }
+    }
+    psf->CompileParamLayout();
+    
+#ifdef EXTERNAL_TAIL
+    // the tail profile does not depend on the bundle, compute it once for all the copies of the PSF
+    psf->PrepareTailProfile(!pyio.use_input_specex_psf);
+#endif
+    
+    // share threads between bundles and image bands of each bundle fit
+    // -------------------------------------------- 
+    int number_of_threads = opts.number_of_threads;
+    if(number_of_threads<=0) {
+      number_of_threads = 1;
+#ifdef _OPENMP
+      number_of_threads = omp_get_max_threads(); // OMP_NUM_THREADS if set, else number of cores
+#endif
+    }
+    int number_of_bundles = opts.last_fiber_bundle-opts.first_fiber_bundle+1;
+    int bundle_threads = max(1,min(opts.bundle_threads,number_of_bundles));
+    int image_band_threads = max(1,number_of_threads/bundle_threads);
+    SPECEX_INFO("Using " << number_of_threads << " threads, fitting " << bundle_threads << " bundle(s) in parallel with " << image_band_threads << " image bands each");
+#ifdef _OPENMP
+    if(bundle_threads>1 && image_band_threads>1) omp_set_max_active_levels(2);
+#endif
+    
+    // fit of bundles, each with its own copy of the PSF
+    // -------------------------------------------- 
+    vector<specex::PSF_p> psf_of_bundle(number_of_bundles);
+    vector< vector<Spot_p> > spots_of_bundle(number_of_bundles);
+    vector<string> error_of_bundle(number_of_bundles);
+    
+#pragma omp parallel for schedule(dynamic) num_threads(bundle_threads)
+    for(int b = 0; b < number_of_bundles ; b ++) {
       
-      fitter.SelectFiberBundle(bundle);
-      
-      // loading arc lamp spots belonging to this bundle
-      // --------------------------------------------
+      int bundle = opts.first_fiber_bundle + b;
       
-      int ymin = 0; // range of usable CCD coordinates, hard coded for now
-      int ymax = pymg.image.n_rows(); // range of usable CCD coordinates, hard coded for now
+      // floating point exceptions are enabled per thread
+      feenableexcept (FE_INVALID|FE_DIVBYZERO|FE_OVERFLOW);
       
-      /*
-      SPECEX_WARNING("RESTRICTING Y RANGE !!!!!");
-      if(psf->camera_id=="b1") {ymin=696; ymax = 3516;};
-      if(psf->camera_id=="b2") {ymin=696; ymax = 3516;};
-      if(psf->camera_id=="r1") {ymin=200; ymax = 3668;}; 
-      if(psf->camera_id=="r2") {ymin=200; ymax = 3668;};
-      */
-
-      int margin = -psf->hSizeY+1; // we need to include spots that contribute to the image signal
-      ymin+=margin;
-      ymax-=margin;
+      try {
+	
+	// a PSF with only the parameters of this bundle (PSF::ParamIndex uses the first bundle)
+	specex::PSF_p bundle_psf = psf->Clone();
+	for(std::map<int,PSF_Params>::iterator it = bundle_psf->ParamsOfBundles.begin(); it != bundle_psf->ParamsOfBundles.end(); ) {
+	  if(it->first != bundle) it = bundle_psf->ParamsOfBundles.erase(it);
+	  else ++it;
+	}
+	bundle_psf->CompileParamLayout();
+	psf_of_bundle[b] = bundle_psf;
+	
+	// init PSF fitter
+	// -------------------------------------------- 
+	PSF_Fitter fitter(bundle_psf,pymg.image,pymg.weight,pymg.rdnoise);
+	
+	fitter.polynomial_degree_along_x    = opts.legendre_deg_x;
+	fitter.polynomial_degree_along_wave = opts.legendre_deg_wave;
+	fitter.corefootprint_weight_bst     = opts.psf_core_wscale;
+	fitter.write_tmp_results            = opts.write_tmp_results;
+	fitter.trace_prior_deg              = opts.trace_prior_deg;
+	
+#ifdef EXTERNAL_TAIL
+	fitter.scheduled_fit_of_psf_tail    = opts.fit_psf_tails;
+	fitter.tail_truncation              = opts.tail_truncation;
+#endif
 
-      SPECEX_INFO("valid y(=rows) range = " << ymin << " " << ymax);
+#ifdef CONTINUUM
+	fitter.scheduled_fit_of_continuum   = opts.fit_continuum;
+#endif
 
-      vector<Spot_p> spots;
+	fitter.scheduled_fit_with_weight_model  = opts.use_variance_model;
+	
+	fitter.scheduled_fit_of_traces      = opts.fit_traces;
+	fitter.scheduled_fit_of_sigmas      = opts.fit_sigmas;
+	fitter.scheduled_fit_of_psf         = opts.fit_thepsf;
+	fitter.direct_simultaneous_fit      = true; // use_input_specex_psf;
+	fitter.max_number_of_lines          = opts.max_number_of_lines;
+	fitter.number_of_threads            = image_band_threads;
+	
+	fitter.priors = pypr.priors;
+	
+	fitter.mask.Clear();
+	
+	fitter.SelectFiberBundle(bundle);
+	
+	// loading arc lamp spots belonging to this bundle
+	// --------------------------------------------
+	
+	int ymin = 0; // range of usable CCD coordinates, hard coded for now
+	int ymax = pymg.image.n_rows(); // range of usable CCD coordinates, hard coded for now
+	
+	/*
+	SPECEX_WARNING("RESTRICTING Y RANGE !!!!!");
+	if(psf->camera_id=="b1") {ymin=696; ymax = 3516;};
+	if(psf->camera_id=="b2") {ymin=696; ymax = 3516;};
+	if(psf->camera_id=="r1") {ymin=200; ymax = 3668;}; 
+	if(psf->camera_id=="r2") {ymin=200; ymax = 3668;};
+	*/
+	
+	int margin = -bundle_psf->hSizeY+1; // we need to include spots that contribute to the image signal
+	ymin+=margin;
+	ymax-=margin;
+	
+	SPECEX_INFO("valid y(=rows) range = " << ymin << " " << ymax);
+	
+	vector<Spot_p>& spots = spots_of_bundle[b];
+	
+	double min_wavelength = 0;
+	double max_wavelength = 1e6;  
+	allocate_spots_of_bundle(spots,opts.lamp_lines_filename,bundle_psf->FiberTraces,
+				 bundle,bundle_psf->ParamsOfBundles[bundle].fiber_min,
+				 bundle_psf->ParamsOfBundles[bundle].fiber_max,ymin,ymax,
+				 min_wavelength,max_wavelength);
+	SPECEX_INFO("number of spots = " << spots.size());
+	
+	// starting fit
+	// --------------------------------------------
+	bool init_psf = (!pyio.use_input_specex_psf);
+	fitter.FitEverything(spots,init_psf);
+	
+	const PSF_Params& params = bundle_psf->ParamsOfBundles[bundle];
+	int ndf = params.ndata - params.nparams;
+	SPECEX_INFO("Bundle " << bundle << " PSF fit status   = " <<
+		    params.fit_status);
+	SPECEX_INFO("Bundle " << bundle << " PSF fit chi2/ndf = " <<
+		    params.chi2 << "/" << ndf <<
+		    " = " << params.chi2/ndf);
+	SPECEX_INFO("Bundle " << bundle << " PSF fit ndata    = "<<
+		    params.ndata);
+	SPECEX_INFO("Bundle " << bundle << " PSF fit nspots   = "<<
+		    params.nspots_in_fit);
+	SPECEX_INFO("Bundle " << bundle << " PSF fit chi2/ndata (core) = "<<
+		    params.chi2_in_core << "/" <<
+		    params.ndata_in_core << " = " <<
+		    params.chi2_in_core /
+		    params.ndata_in_core);
+	
+	if(opts.fit_individual_spots_position) // for debugging
+	  fitter.FitIndividualSpotPositions(spots);
+	
+      }
+      catch (std::exception& e) {
+	error_of_bundle[b] = string("(other std) ") + e.what();
+      }catch (...) {
+	error_of_bundle[b] = "(unknown)";
+      }
       
-      double min_wavelength = 0;
-      double max_wavelength = 1e6;  
-      allocate_spots_of_bundle(spots,opts.lamp_lines_filename,psf->FiberTraces,
-			       bundle,psf->ParamsOfBundles[bundle].fiber_min,
-			       psf->ParamsOfBundles[bundle].fiber_max,ymin,ymax,
-			       min_wavelength,max_wavelength);
-      SPECEX_INFO("number of spots = " << spots.size());
+      fedisableexcept (FE_INVALID|FE_DIVBYZERO|FE_OVERFLOW);
       
-      // starting fit
-      // --------------------------------------------
-      bool init_psf = (!pyio.use_input_specex_psf);
-      fitter.FitEverything(spots,init_psf);
-
-      int ndf = psf->ParamsOfBundles[bundle].ndata - psf->ParamsOfBundles[bundle].nparams;
-      SPECEX_INFO("Bundle " << bundle << " PSF fit status   = " <<
-		  psf->ParamsOfBundles[bundle].fit_status);
-      SPECEX_INFO("Bundle " << bundle << " PSF fit chi2/ndf = " <<
-		  psf->ParamsOfBundles[bundle].chi2 << "/" << ndf <<
-		  " = " << psf->ParamsOfBundles[bundle].chi2/ndf);
-      SPECEX_INFO("Bundle " << bundle << " PSF fit ndata    = "<<
-		  psf->ParamsOfBundles[bundle].ndata);
-      SPECEX_INFO("Bundle " << bundle << " PSF fit nspots   = "<<
-		  psf->ParamsOfBundles[bundle].nspots_in_fit);
-      SPECEX_INFO("Bundle " << bundle << " PSF fit chi2/ndata (core) = "<<
-		  psf->ParamsOfBundles[bundle].chi2_in_core << "/" <<
-		  psf->ParamsOfBundles[bundle].ndata_in_core << " = " <<
-		  psf->ParamsOfBundles[bundle].chi2_in_core /
-		  psf->ParamsOfBundles[bundle].ndata_in_core);
+    } // end of loop on bundles
+    
+    feenableexcept (FE_INVALID|FE_DIVBYZERO|FE_OVERFLOW);
+    
+    for(int b = 0; b < number_of_bundles ; b ++) {
+      if(error_of_bundle[b] != "") {
+	cerr << "FATAL ERROR " << error_of_bundle[b] << endl;
+	return EXIT_FAILURE;
+      }
+    }
+    
+    // merge the results of the bundles, in bundle order
+    // -------------------------------------------- 
+    int first_fitted_fiber=-1;
+    int last_fitted_fiber=-1;
+    
+    for(int b = 0; b < number_of_bundles ; b ++) {
+      
+      int bundle = opts.first_fiber_bundle + b;
+      const specex::PSF_p bundle_psf = psf_of_bundle[b];
+      const PSF_Params& params = bundle_psf->ParamsOfBundles.find(bundle)->second;
+      
+      psf->ParamsOfBundles[bundle] = params;
+      
+      // the fit of a bundle only modifies the traces of its fibers
+      for(int fiber = params.fiber_min; fiber <= params.fiber_max; fiber++) {
+	std::map<int,specex::Trace>::const_iterator it = bundle_psf->FiberTraces.find(fiber);
+	if(it != bundle_psf->FiberTraces.end())
+	  psf->FiberTraces[fiber] = it->second;
+      }
       
       if(bundle == opts.first_fiber_bundle) {
-	first_fitted_fiber=psf->ParamsOfBundles[bundle].fiber_min;
-	last_fitted_fiber=psf->ParamsOfBundles[bundle].fiber_max;
+	first_fitted_fiber=params.fiber_min;
+	last_fitted_fiber=params.fiber_max;
       }
       
-      first_fitted_fiber=min(first_fitted_fiber,psf->ParamsOfBundles[bundle].fiber_min);
-      last_fitted_fiber=max(last_fitted_fiber,psf->ParamsOfBundles[bundle].fiber_max);
-          
+      first_fitted_fiber=min(first_fitted_fiber,params.fiber_min);
+      last_fitted_fiber=max(last_fitted_fiber,params.fiber_max);
+      
+      const vector<Spot_p>& spots = spots_of_bundle[b];
       for(size_t s=0;s<spots.size();s++) {
 	pyps.fitted_spots.push_back(spots[s]);
       }
-
-      if(opts.fit_individual_spots_position) // for debugging
-	fitter.FitIndividualSpotPositions(spots);
-
-    } // end of loop on bundles
-
-    pyps.psf = fitter.psf;
+    }
+    
+    psf->CompileParamLayout();
+    pyps.psf = psf;
 
   // ending
   // --------------------------------------------   
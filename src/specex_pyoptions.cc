@@ -58,12 +58,17 @@ void PrintHelp()
     "--tmp_results         write tmp results\n"  
 #ifdef EXTERNAL_TAIL
     "--fit-psf-tails       unable fit of psf tails\n"
+    "--tail-truncation     psf tails are not computed where the sum of the omitted tails of all spots is\n"
+    "                      below this fraction of the read noise, e.g. 0.01 (default is 0 = no truncation)\n"
 #endif
 #ifdef CONTINUUM
     "--fit-continuum       unable fit of continuum\n"
 #endif
     "--nlines              max # emission lines used (uses an algorithm to select best ones \n"
-    "                      based on S/N and line coverage\n";
+    "                      based on S/N and line coverage\n"
+    "--nthreads            number of threads (default is 0 = OMP_NUM_THREADS or number of cores)\n"
+    "--bundle-threads      number of fiber bundles fit concurrently (default is 1), the threads\n"
+    "                      are shared among them\n";
 
   return;
   
@@ -136,11 +141,14 @@ int specex::PyOptions::parse(int argc, char *argv[] )
   loadmap(optmap, "tmp_results",        optional_argument);
 #ifdef EXTERNAL_TAIL
   loadmap(optmap, "fit-psf-tails",      optional_argument);
+  loadmap(optmap, "tail-truncation",    required_argument);
 #endif
 #ifdef CONTINUUM
   loadmap(optmap, "fit-continuum",      optional_argument);
 #endif
   loadmap(optmap, "nlines",             required_argument);
+  loadmap(optmap, "nthreads",           required_argument);
+  loadmap(optmap, "bundle-threads",     required_argument);
  
   int i = 0;
   for (it = optmap.begin(); it !=optmap.end(); it++){
@@ -248,6 +256,8 @@ int specex::PyOptions::parse(int argc, char *argv[] )
 #ifdef EXTERNAL_TAIL
       } else if (opt == argint(optmap, "fit-psf-tails")){
 	fit_psf_tails = true;
+      } else if (opt == argint(optmap, "tail-truncation")){
+	tail_truncation = stod(optarg);
 #endif
 #ifdef CONTINUUM
       } else if (opt == argint(optmap, "fit-continuum")){
@@ -269,6 +279,10 @@ int specex::PyOptions::parse(int argc, char *argv[] )
 	write_tmp_results = true;
       } else if (opt == argint(optmap, "nlines")){
 	max_number_of_lines = stoi(optarg);
+      } else if (opt == argint(optmap, "nthreads")){
+	number_of_threads = stoi(optarg);
+      } else if (opt == argint(optmap, "bundle-threads")){
+	bundle_threads = stoi(optarg);
       }
     }
 
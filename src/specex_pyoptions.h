@@ -46,7 +46,10 @@ namespace specex {
     int trace_prior_deg; 
     double psf_error; 
     double psf_core_wscale; 
+    double tail_truncation; 
     int max_number_of_lines; 
+    int bundle_threads; 
+    int number_of_threads; 
     
     std::string broken_fibers_string;
     std::string lamp_lines_filename;
@@ -105,7 +108,10 @@ namespace specex {
       trace_prior_deg=0;
       psf_error=0;
       psf_core_wscale=0;
+      tail_truncation=0;
       max_number_of_lines=200; 
+      bundle_threads=1; 
+      number_of_threads=0; 
     
       broken_fibers_string="";
 
@@ -176,6 +176,7 @@ void specex::PyPSF::set_psf(
     }    
     psf->ParamsOfBundles[bundle] = bundle_params;
   } 
+  psf->CompileParamLayout();
 
 }
 
@@ -212,6 +213,7 @@ void specex::PyPSF::synchronize_traces(){
     trace.X_vs_Y = specex::Legendre1DPol(deg+ddeg,0,4000);
     trace.X_vs_Y.Fit(ty,tx,0,true);    
     trace.W_vs_Y = trace.Y_vs_W.Invert(ddeg);
+    trace.ClearRowTable();
     trace.synchronized=true;
     
     if(it==psf->FiberTraces.begin()) {
@@ -15,6 +15,22 @@ specex::Trace::Trace(int i_fiber) :
   fiber(i_fiber)
 {
   synchronized=false;
+  row_table_begin_j=0;
+}
+
+void specex::Trace::SetRowTable(int begin_j, int end_j) {
+  row_table_begin_j = begin_j;
+  int nrows = max(0,end_j-begin_j);
+  unbls::vector_double rows(nrows);
+  for(int k=0;k<nrows;k++) rows[k] = begin_j+k;
+  X_vs_Y.Values(rows,row_x);
+  W_vs_Y.Values(rows,row_w);
+}
+
+void specex::Trace::ClearRowTable() {
+  row_table_begin_j = 0;
+  row_x.clear();
+  row_w.clear();
 }
 
 void specex::Trace::resize(int ncoeff) {
@@ -40,6 +56,7 @@ void specex::Trace::resize(int ncoeff) {
   X_vs_Y.coeff.resize(ncoeff);
   X_vs_Y.coeff = specex::unbst::subrange(coeff,0,min(ncoeff,int(coeff.size())));
   
+  if(row_x.size()) SetRowTable(row_table_begin_j,row_table_begin_j+int(row_x.size()));
 }
 
 bool specex::Trace::Fit(std::vector<specex::Spot_p> spots, bool set_xy_range) {
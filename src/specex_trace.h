@@ -42,8 +42,28 @@ namespace specex {
     
     bool Off() const;
 
+    // X_vs_Y and W_vs_Y tabulated at the integer rows [begin_j,end_j[ , to replace the polynomial evaluations
+    // in the loops on ccd rows. the table follows the changes of degree by resize.
+    void SetRowTable(int begin_j, int end_j);
+    void ClearRowTable();
+    
+    // X_vs_Y and W_vs_Y at row j, from the table if it contains the row
+    inline double XofRow(const int j) const {
+      int k = j-row_table_begin_j;
+      if(k>=0 && k<int(row_x.size())) return row_x[k];
+      return X_vs_Y.Value(double(j));
+    }
+    inline double WofRow(const int j) const {
+      int k = j-row_table_begin_j;
+      if(k>=0 && k<int(row_w.size())) return row_w[k];
+      return W_vs_Y.Value(double(j));
+    }
+    
     private :
-
+    
+    int row_table_begin_j;
+    std::vector<double> row_x; // X_vs_Y of rows row_table_begin_j+k
+    std::vector<double> row_w; // W_vs_Y of rows row_table_begin_j+k
   };
   
   // SDSS IO